@@ -0,0 +1,208 @@
+#pragma once
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "color.hpp"
+#include "image.hpp"
+#include "renderer.hpp"
+
+
+// where a single image was packed into a texture atlas, and how uvs of the image turn into uvs of its page
+struct AtlasRegion3D
+{
+    int page = 0;
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+    glm::vec2 uv_offset = glm::vec2(0.0f);
+    glm::vec2 uv_scale = glm::vec2(1.0f);
+    
+    // turns a uv of the original image into a uv of the page it was packed into
+    inline glm::vec2 MapUV(const glm::vec2& uv) const
+    {
+        return uv_offset + uv * uv_scale;
+    }
+};
+
+
+// a few large images, called pages, that many smaller images were packed into, so that everything textured with any
+// of them can be drawn with the same sampler
+struct TextureAtlas3D
+{
+    std::vector<Image3D> pages;
+    
+    // where each image given to BuildAtlas ended up, in the same order
+    std::vector<AtlasRegion3D> regions;
+    
+    // returns the page the image at the given index was packed into
+    inline const Image3D* GetPage(size_t image) const
+    {
+        return &pages[regions[image].page];
+    }
+};
+
+
+// packs the given images into as few ARGB8888 pages of at most the given size as it can, in rows sorted by height
+// (every image gets surrounded by copies of its edge pixels so that sampling right at its edges never reads its
+// neighbors, and cells start on multiples of 4 pixels so that pages compressed with ConvertImage keep their blocks
+// within a single image; images bigger than a page get a page of their own)
+inline TextureAtlas3D BuildAtlas(const std::vector<const Image3D*>& images, int page_size = 1024, int padding = 4)
+{
+    TextureAtlas3D atlas;
+    atlas.regions.resize(images.size());
+    
+    auto align = [](int size) { return (size + 3) / 4 * 4; };
+    
+    // taller images go first, so that rows waste as little height as possible
+    std::vector<size_t> order(images.size());
+    std::iota(order.begin(), order.end(), 0);
+    
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+    {
+        return images[a]->height > images[b]->height;
+    });
+    
+    // plan where every image goes, and how big every page needs to be
+    std::vector<glm::ivec2> page_sizes;
+    int row_x = 0;
+    int row_y = 0;
+    int row_height = 0;
+    int open_page = -1;
+    
+    for (auto i: order)
+    {
+        auto& image = *images[i];
+        auto& region = atlas.regions[i];
+        auto cell_width = align(image.width + padding * 2);
+        auto cell_height = align(image.height + padding * 2);
+        
+        region.width = image.width;
+        region.height = image.height;
+        
+        if (cell_width > page_size || cell_height > page_size)
+        {
+            region.page = (int)page_sizes.size();
+            region.x = padding;
+            region.y = padding;
+            page_sizes.push_back(glm::ivec2(cell_width, cell_height));
+            continue;
+        }
+        
+        // start a new row when this one is full, and a new page when there's no room for another row
+        if (open_page >= 0 && row_x + cell_width > page_size)
+        {
+            row_x = 0;
+            row_y += row_height;
+            row_height = 0;
+        }
+        
+        if (open_page < 0 || row_y + cell_height > page_size)
+        {
+            open_page = (int)page_sizes.size();
+            page_sizes.push_back(glm::ivec2(0, 0));
+            row_x = 0;
+            row_y = 0;
+            row_height = 0;
+        }
+        
+        region.page = open_page;
+        region.x = row_x + padding;
+        region.y = row_y + padding;
+        
+        row_x += cell_width;
+        row_height = std::max(row_height, cell_height);
+        
+        auto& used = page_sizes[open_page];
+        used = glm::ivec2(std::max(used.x, row_x), std::max(used.y, row_y + row_height));
+    }
+    
+    // copy every image into its page, along with the padding around it
+    for (auto& size: page_sizes)
+    {
+        atlas.pages.emplace_back(size.x, size.y);
+    }
+    
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        auto& image = *images[i];
+        auto& region = atlas.regions[i];
+        auto& page = atlas.pages[region.page];
+        
+        if (image.IsEmpty())
+        { continue; }
+        
+        for (int y = -padding; y < image.height + padding; ++y)
+        {
+            for (int x = -padding; x < image.width + padding; ++x)
+            {
+                auto color = image.Read(std::clamp(x, 0, image.width - 1), std::clamp(y, 0, image.height - 1));
+                page.WritePixel(region.x + x, region.y + y, page.Map(color));
+            }
+        }
+        
+        // v goes from the bottom of an image to its top, while rows go from the top to the bottom
+        auto page_dims = glm::vec2(page.width, page.height);
+        region.uv_offset = glm::vec2(region.x, page.height - region.y - region.height) / page_dims;
+        region.uv_scale = glm::vec2(region.width, region.height) / page_dims;
+    }
+    
+    return atlas;
+}
+
+
+// rewrites the uvs of a model textured with an image so that it can be textured with the page it was packed into
+// instead (uvs outside of [0, 1] would sample neighboring images, rather than nothing)
+inline void RemapModelUVs(Model3D& model, const AtlasRegion3D& region)
+{
+    for (auto& triangle: model.triangles)
+    {
+        for (auto& vertex: triangle.vertices)
+        {
+            vertex.uv = region.MapUV(vertex.uv);
+        }
+    }
+}
+
+
+// reorders instances so that ones drawn with the same state are drawn one after another, which means models sharing an
+// atlas page are drawn back to back while its pixels are still in the cache
+// (instances with the same state keep their order, so results only change where instances overlap at the same depth)
+inline void SortInstancesByState(std::vector<Instance3D>& instances)
+{
+    std::stable_sort(instances.begin(), instances.end(), [](const Instance3D& a, const Instance3D& b)
+    {
+        if (a.state.sampler != b.state.sampler)
+        { return std::less<const Image3D*>()(a.state.sampler, b.state.sampler); }
+        
+        if (a.state.virtual_texture != b.state.virtual_texture)
+        { return std::less<const VirtualTexture3D*>()(a.state.virtual_texture, b.state.virtual_texture); }
+        
+        if (a.state.shading_rate != b.state.shading_rate)
+        { return a.state.shading_rate < b.state.shading_rate; }
+        
+        return a.state.linear_light < b.state.linear_light;
+    });
+}
+
+
+// counts how many times the state changes between consecutive instances, to see how well they batch
+inline size_t CountStateChanges(const std::vector<Instance3D>& instances)
+{
+    size_t changes = 0;
+    
+    for (size_t i = 1; i < instances.size(); ++i)
+    {
+        auto& a = instances[i - 1].state;
+        auto& b = instances[i].state;
+        changes +=
+            a.sampler != b.sampler || a.virtual_texture != b.virtual_texture || a.shading_rate != b.shading_rate ||
+            a.linear_light != b.linear_light;
+    }
+    
+    return changes;
+}
\ No newline at end of file
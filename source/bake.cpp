@@ -0,0 +1,187 @@
+#include <utility>
+#include <cmath>
+#include <optional>
+#include <array>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+#include <glm/glm.hpp>
+#include <glm/gtx/rotate_vector.hpp>
+
+#include "math.hpp"
+#include "renderer.hpp"
+#include "mesh.hpp"
+#include "raycast.hpp"
+#include "parallel.hpp"
+
+
+// settings for a single bake
+struct BakeSettings
+{
+    // number of ambient occlusion rays per vertex
+    int samples = 64;
+    
+    // how far away geometry can be and still occlude a vertex
+    float ao_radius = 2.0f;
+    
+    // direction pointing towards the light
+    glm::vec3 light_dir = glm::normalize(glm::vec3(0.4f, 1.0f, -0.3f));
+    
+    // how much ambient and direct light contribute to the final color
+    float ambient = 0.6f;
+    float direct = 0.6f;
+};
+
+
+// returns the i-th point of an n point hammersley sequence, which covers the unit square more evenly than random points
+inline glm::vec2 Hammersley(uint32_t i, uint32_t n)
+{
+    auto bits = i;
+    bits = (bits << 16) | (bits >> 16);
+    bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+    bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+    bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+    bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+    
+    return glm::vec2((i + 0.5f) / n, bits * 2.3283064365386963e-10f);
+}
+
+
+// turns a point on the unit square into a cosine weighted direction around the given normal
+inline glm::vec3 CosineHemisphere(const glm::vec2& point, const glm::vec3& normal)
+{
+    auto radius = std::sqrt(point.x);
+    auto angle = 6.28318530718f * point.y;
+    auto local = glm::vec3(radius * std::cos(angle), radius * std::sin(angle), std::sqrt(std::max(0.0f, 1.0f - point.x)));
+    
+    // build an orthonormal basis around the normal
+    auto helper = std::abs(normal.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+    auto tangent = glm::normalize(glm::cross(helper, normal));
+    auto bitangent = glm::cross(normal, tangent);
+    
+    return tangent * local.x + bitangent * local.y + normal * local.z;
+}
+
+
+// computes how much light reaches the given point, in the range [0, 1 + direct]
+inline float BakeVertex(const Model3D& model, const BakeSettings& settings, const glm::vec3& pos, const glm::vec3& normal, uint32_t seed)
+{
+    auto identity = glm::mat4(1.0f);
+    
+    // rays start slightly above the surface so they don't hit the triangle they start from
+    auto origin = pos + normal * 1e-3f;
+    
+    // every vertex rotates the sample pattern by a different amount, which trades banding for noise
+    auto rotation = Hammersley(seed % 1021, 1021);
+    
+    int unoccluded = 0;
+    
+    for (int s = 0; s < settings.samples; ++s)
+    {
+        auto point = Hammersley(s, settings.samples) + rotation;
+        point = point - glm::floor(point);
+        
+        Ray3D ray{ origin, CosineHemisphere(point, normal), settings.ao_radius };
+        
+        if (!Occluded(model, identity, ray))
+        { unoccluded += 1; }
+    }
+    
+    auto ao = (float)unoccluded / settings.samples;
+    
+    // direct light is only received by surfaces that face it and aren't in shadow
+    auto lambert = std::max(0.0f, glm::dot(normal, settings.light_dir));
+    
+    if (lambert > 0.0f && Occluded(model, identity, Ray3D{ origin, settings.light_dir }))
+    { lambert = 0.0f; }
+    
+    return settings.ambient * ao + settings.direct * lambert;
+}
+
+
+// bakes ambient occlusion and direct lighting into the vertex colors of the given model, using every core
+inline void BakeModel(Model3D& model, const BakeSettings& settings)
+{
+    // the source model is left untouched while rays are traced against it
+    auto baked = model.triangles;
+    
+    ParallelFor(model.triangles.size(), [&](size_t begin, size_t end)
+    {
+        for (auto t = begin; t < end; ++t)
+        {
+            auto& verts = model.triangles[t].vertices;
+            auto pos0 = glm::vec3(verts[0].pos);
+            auto pos1 = glm::vec3(verts[1].pos);
+            auto pos2 = glm::vec3(verts[2].pos);
+            
+            // front faces are the ones the renderer draws, which wind this way around their normal
+            auto normal = glm::cross(pos2 - pos0, pos1 - pos0);
+            
+            if (glm::dot(normal, normal) == 0.0f)
+            { continue; }
+            
+            normal = glm::normalize(normal);
+            
+            for (size_t v = 0; v < 3; ++v)
+            {
+                auto light = BakeVertex(model, settings, glm::vec3(verts[v].pos), normal, (uint32_t)(t * 3 + v));
+                auto& color = baked[t].vertices[v].color;
+                
+                color = glm::vec4(glm::vec3(color) * light, color.w);
+            }
+        }
+    });
+    
+    model.triangles = std::move(baked);
+}
+
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: smolsoft3d_bake <input model> <output model> [samples] [ao radius]" << std::endl;
+        return 1;
+    }
+    
+    BakeSettings settings;
+    
+    if (argc > 3)
+    { settings.samples = std::max(1, std::atoi(argv[3])); }
+    
+    if (argc > 4)
+    { settings.ao_radius = (float)std::atof(argv[4]); }
+    
+    // load the model to bake
+    auto model = LoadModel(argv[1]);
+    
+    if (!model)
+    {
+        std::cerr << "could not load " << argv[1] << std::endl;
+        return 1;
+    }
+    
+    // bake and time it
+    auto start = std::chrono::steady_clock::now();
+    BakeModel(model.value(), settings);
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    
+    std::cout << "baked " << model->triangles.size() << " triangles with " << settings.samples << " samples on ";
+    std::cout << GetWorkerCount() << " threads in " << seconds << "s" << std::endl;
+    
+    // save the result in a format LoadModel can read back, or as a binary mesh with quantized positions for LoadMesh
+    auto binary = fs::path(argv[2]).extension() == ".mesh";
+    
+    if (binary ? !SaveMesh(argv[2], model.value(), MeshPositions3D::Quantized16) : !SaveModel(argv[2], model.value()))
+    {
+        std::cerr << "could not save " << argv[2] << std::endl;
+        return 1;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,600 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtx/rotate_vector.hpp>
+
+#include "simd.hpp"
+#include "image.hpp"
+#include "palette.hpp"
+#include "renderer.hpp"
+#include "commands.hpp"
+#include "parallel.hpp"
+#include "setup.hpp"
+#include "stress.hpp"
+
+
+// inputs shared by every kernel, sized like a full frame
+struct BenchBuffers
+{
+    static constexpr int width = 400;
+    static constexpr int height = 240;
+    static constexpr int texture_size = 64;
+    
+    std::vector<Uint32> pixels_a;
+    std::vector<Uint32> pixels_b;
+    std::vector<Uint32> texels;
+    std::vector<float> u;
+    std::vector<float> v;
+    std::vector<float> depths;
+    std::vector<float> w;
+    
+    // fills every input with the same pseudo random values on every run, so results can be compared between runs
+    inline BenchBuffers()
+    {
+        auto count = (size_t)(width * height);
+        Uint32 state = 12345;
+        
+        auto next = [&]()
+        {
+            state = state * 1664525u + 1013904223u;
+            return state;
+        };
+        
+        pixels_a.resize(count);
+        pixels_b.resize(count);
+        u.resize(count);
+        v.resize(count);
+        depths.resize(count);
+        w.resize(count);
+        texels.resize(texture_size * texture_size);
+        
+        for (size_t i = 0; i < count; ++i)
+        {
+            pixels_a[i] = next();
+            pixels_b[i] = next();
+            
+            // a few coordinates fall outside of the texture, like they do along the edges of triangles
+            u[i] = (next() >> 8) / 16777216.0f * 1.1f - 0.05f;
+            v[i] = (next() >> 8) / 16777216.0f * 1.1f - 0.05f;
+            depths[i] = (next() >> 8) / 16777216.0f;
+            
+            // w is 1/z, for points between the near plane and far into the distance
+            w[i] = 1.0f / (0.1f + depths[i] * 1000.0f);
+        }
+        
+        for (auto& texel: texels)
+        {
+            texel = next();
+        }
+    }
+};
+
+
+// what running a kernel on one backend produced, and how long it took
+struct BenchResult
+{
+    std::vector<Uint32> pixels;
+    std::vector<float> floats;
+    std::vector<Uint8> mask;
+    double seconds = 0.0;
+};
+
+
+// runs the given kernel the given number of times and keeps the output of the last run
+inline BenchResult RunKernel(int iterations, const std::function<void(BenchResult&)>& kernel)
+{
+    BenchResult result;
+    
+    // warm up caches and allocate outputs before timing anything
+    kernel(result);
+    
+    auto start = std::chrono::steady_clock::now();
+    
+    for (int i = 0; i < iterations; ++i)
+    {
+        kernel(result);
+    }
+    
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / iterations;
+    return result;
+}
+
+
+// describes how closely a backend's output matches the scalar one (integers must match exactly, floats nearly)
+inline std::string CompareResults(const BenchResult& reference, const BenchResult& result)
+{
+    size_t mismatches = 0;
+    double max_error = 0.0;
+    
+    for (size_t i = 0; i < std::min(reference.pixels.size(), result.pixels.size()); ++i)
+    {
+        mismatches += reference.pixels[i] != result.pixels[i];
+    }
+    
+    for (size_t i = 0; i < std::min(reference.mask.size(), result.mask.size()); ++i)
+    {
+        mismatches += reference.mask[i] != result.mask[i];
+    }
+    
+    for (size_t i = 0; i < std::min(reference.floats.size(), result.floats.size()); ++i)
+    {
+        auto error = std::abs((double)reference.floats[i] - result.floats[i]) / std::max(std::abs((double)reference.floats[i]), 1e-30);
+        max_error = std::max(max_error, error);
+    }
+    
+    // errors are tiny, so they're written in scientific notation
+    std::ostringstream error;
+    error << std::scientific << std::setprecision(2) << max_error;
+    
+    // a pass/fail flip right at the depth of a pixel is expected when depths differ in their last bit
+    if (mismatches == 0 && max_error == 0.0)
+    { return "exact"; }
+    else if (max_error < 1e-6 && (mismatches == 0 || mismatches * 10000 < reference.mask.size() + reference.pixels.size()))
+    { return "ok (max relative error " + error.str() + ", " + std::to_string(mismatches) + " flips)"; }
+    else
+    { return "MISMATCH (" + std::to_string(mismatches) + " values, max relative error " + error.str() + ")"; }
+}
+
+
+// benchmarks every kernel on the scalar backend and on the native one, and reports how they compare
+inline bool RunKernelBenchmarks(int iterations)
+{
+    BenchBuffers buffers;
+    auto count = buffers.pixels_a.size();
+    
+    // each kernel gets run with the same inputs on every backend
+    std::vector<std::pair<std::string, std::function<void(const SimdKernels3D&, BenchResult&)>>> kernels
+    {
+        { "fill_pixels", [&](const SimdKernels3D& k, BenchResult& out)
+        {
+            out.pixels.resize(count);
+            k.fill_pixels(out.pixels.data(), count, 0xFF204080);
+        }},
+        { "fill_depth", [&](const SimdKernels3D& k, BenchResult& out)
+        {
+            out.floats.resize(count);
+            k.fill_depth(out.floats.data(), count, 1.0f);
+        }},
+        { "modulate_pixels", [&](const SimdKernels3D& k, BenchResult& out)
+        {
+            out.pixels.resize(count);
+            k.modulate_pixels(out.pixels.data(), buffers.pixels_a.data(), buffers.pixels_b.data(), count);
+        }},
+        { "modulate_pixels_linear", [&](const SimdKernels3D& k, BenchResult& out)
+        {
+            out.pixels.resize(count);
+            k.modulate_pixels_linear(out.pixels.data(), buffers.pixels_a.data(), buffers.pixels_b.data(), count);
+        }},
+        { "sample_nearest", [&](const SimdKernels3D& k, BenchResult& out)
+        {
+            auto size = BenchBuffers::texture_size;
+            out.pixels.resize(count);
+            k.sample_nearest(out.pixels.data(), buffers.texels.data(), size, size, size, buffers.u.data(), buffers.v.data(), count);
+        }},
+        { "depth_span", [&](const SimdKernels3D& k, BenchResult& out)
+        {
+            // one span per row, with depths that cross the depth buffer's halfway through
+            auto width = (size_t)BenchBuffers::width;
+            out.floats.resize(count);
+            out.mask.resize(count);
+            
+            for (size_t row = 0; row < count; row += width)
+            {
+                k.depth_span(&out.floats[row], &out.mask[row], &buffers.depths[row], width, 5000.0f, -0.5f, 1.0f, 0.001f);
+            }
+        }},
+        { "reciprocal", [&](const SimdKernels3D& k, BenchResult& out)
+        {
+            out.floats.resize(count);
+            k.reciprocal(out.floats.data(), buffers.w.data(), count);
+        }},
+    };
+    
+    std::vector<SimdBackend> backends{ SimdBackend::Scalar };
+    
+    if (native_simd_backend != SimdBackend::Scalar)
+    { backends.push_back(native_simd_backend); }
+    
+    std::cout << "native backend: " << GetSimdBackendName(native_simd_backend) << ", " << iterations << " iterations of ";
+    std::cout << BenchBuffers::width << "x" << BenchBuffers::height << " pixels\n\n";
+    
+    std::cout << std::left << std::setw(24) << "kernel" << std::setw(10) << "backend" << std::right;
+    std::cout << std::setw(12) << "Mpixels/s" << std::setw(10) << "speedup" << "   parity\n";
+    
+    bool all_match = true;
+    
+    for (auto& [name, kernel]: kernels)
+    {
+        BenchResult reference;
+        
+        for (auto backend: backends)
+        {
+            auto& k = GetSimdKernels(backend);
+            auto result = RunKernel(iterations, [&](BenchResult& out) { kernel(k, out); });
+            
+            std::string parity = "reference";
+            
+            if (backend == SimdBackend::Scalar)
+            { reference = result; }
+            else
+            { parity = CompareResults(reference, result); }
+            
+            all_match = all_match && parity.rfind("MISMATCH", 0) != 0;
+            
+            std::cout << std::left << std::setw(24) << name << std::setw(10) << GetSimdBackendName(backend) << std::right;
+            std::cout << std::fixed << std::setprecision(1) << std::setw(12) << count / result.seconds / 1e6;
+            std::cout << std::setprecision(2) << std::setw(9) << reference.seconds / result.seconds << "x";
+            std::cout << "   " << parity << "\n";
+        }
+    }
+    
+    return all_match;
+}
+
+
+// measures how fast threads write and read memory depending on where they run, to show what pinning threads and keeping
+// memory on the right NUMA node is worth on this machine (set SMOLSOFT3D_THREADS and friends to try other placements)
+inline void RunPlacementBenchmark(int iterations)
+{
+    auto& nodes = GetNumaNodes();
+    auto placement = GetThreadPlacement();
+    auto repeats = iterations / 10 + 1;
+    
+    std::cout << "\n" << GetWorkerCount() << " threads, " << nodes.size() << " numa nodes:";
+    
+    for (auto& node: nodes)
+    {
+        std::cout << " node " << node.id << " (" << node.cpus.size() << " cpus)";
+    }
+    
+    std::cout << "\n";
+    
+    // a surface much bigger than any cache, with every thread clearing its own rows of tiles the way it first wrote them
+    for (auto pin: { false, true })
+    {
+        auto changed = placement;
+        changed.pin = pin;
+        SetThreadPlacement(changed);
+        
+        TiledSurface3D surface(4096, 4096);
+        
+        auto result = RunKernel(repeats, [&](BenchResult&)
+        {
+            ParallelFor(surface.rows, [&](size_t begin, size_t end)
+            {
+                for (auto ty = (int)begin; ty < (int)end; ++ty)
+                {
+                    for (int tx = 0; tx < surface.columns; ++tx)
+                    {
+                        surface.FillTile(tx, ty, 0xFF204080, 0.5f);
+                    }
+                }
+            });
+        });
+        
+        auto bytes = (double)surface.rows * surface.columns * TiledSurface3D::tile_pixels * 8;
+        std::cout << (pin ? "pinned" : "unpinned") << " threads clearing a 4096x4096 tiled surface: ";
+        std::cout << std::fixed << std::setprecision(1) << bytes / result.seconds / 1e9 << " GB/s\n";
+    }
+    
+    SetThreadPlacement(placement);
+    
+    // memory first written on one node, read by a single thread on every node
+    if (nodes.size() > 1)
+    {
+        std::vector<Uint32> memory;
+        RunOnNumaNode(nodes[0], [&]() { memory.assign(1 << 24, 1); });
+        
+        for (auto& node: nodes)
+        {
+            volatile Uint64 sum = 0;
+            double seconds = 0.0;
+            
+            RunOnNumaNode(node, [&]()
+            {
+                seconds = RunKernel(repeats, [&](BenchResult&) { sum = sum + std::accumulate(memory.begin(), memory.end(), Uint64(0)); }).seconds;
+            });
+            
+            std::cout << "thread on node " << node.id << " reading memory of node " << nodes[0].id << ": ";
+            std::cout << std::fixed << std::setprecision(1) << memory.size() * sizeof(Uint32) / seconds / 1e9 << " GB/s\n";
+        }
+    }
+}
+
+
+// hashes every pixel of an image, so that replays can be checked for drawing exactly the same thing across builds
+inline Uint64 HashImage(const Image3D& image)
+{
+    Uint64 hash = 14695981039346656037ull;
+    
+    for (int y = 0; y < image.height; ++y)
+    {
+        auto row = image.GetRow(y);
+        
+        for (int i = 0; i < image.width * image.GetBytesPerPixel(); ++i)
+        {
+            hash = (hash ^ row[i]) * 1099511628211ull;
+        }
+    }
+    
+    return hash;
+}
+
+
+// replays a frame saved by SaveCommands the given number of times and reports how long it took to draw
+// (images are replaced by generated ones of the same size and format, since the bench can't decode image files)
+inline bool RunReplayBenchmark(int iterations, const fs::path& filepath)
+{
+    auto frame = LoadCommands(filepath);
+    
+    if (!frame)
+    {
+        std::cerr << "could not load recorded frame " << filepath << "\n";
+        return false;
+    }
+    
+    Palette3D palette;
+    CommandResources3D resources;
+    
+    // models are looked up as saved first, then next to the recorded frame
+    std::vector<Model3D> models(frame->model_names.size());
+    
+    for (size_t i = 0; i < models.size(); ++i)
+    {
+        auto& name = frame->model_names[i];
+        auto model = LoadModel(name);
+        
+        if (!model)
+        { model = LoadModel(filepath.parent_path() / name); }
+        
+        if (!model)
+        {
+            std::cerr << "could not load model " << name << "\n";
+            return false;
+        }
+        
+        models[i] = std::move(model.value());
+        resources.AddModel(models[i], name);
+    }
+    
+    // stand in images with a checker pattern, which costs as much to sample as the real ones
+    std::vector<Image3D> images;
+    images.reserve(frame->images.size());
+    
+    for (auto& recorded: frame->images)
+    {
+        // compressed images are drawn uncompressed first, since their pixels can't be written one by one
+        auto compressed = recorded.format == PixelFormat3D::BC1;
+        Image3D image(recorded.width, recorded.height, compressed ? PixelFormat3D::ARGB8888 : recorded.format);
+        image.palette = recorded.format == PixelFormat3D::Index8 ? &palette : nullptr;
+        
+        for (int y = 0; y < image.height; ++y)
+        {
+            for (int x = 0; x < image.width; ++x)
+            {
+                auto light = ((x / 8 + y / 8) & 1) != 0;
+                image.WritePixel(x, y, image.Map(light ? Color3D{ 255, 128, 64, 255 } : Color3D{ 32, 64, 255, 255 }));
+            }
+        }
+        
+        images.push_back(compressed ? CompressImage(image) : image);
+        resources.AddImage(images.back(), recorded.name);
+    }
+    
+    Image3D target_image(frame->width, frame->height, frame->format);
+    target_image.palette = frame->format == PixelFormat3D::Index8 ? &palette : nullptr;
+    
+    Target target = target_image;
+    Screen screen{ (float)frame->width, (float)frame->height, frame->fov };
+    Renderer3D renderer;
+    
+    size_t draws = std::count_if(frame->buffer.commands.begin(), frame->buffer.commands.end(), [](auto& command)
+    {
+        return command.type == CommandType3D::DrawModel;
+    });
+    
+    auto result = RunKernel(iterations, [&](BenchResult&)
+    {
+        target.ClearSurface({ 0, 0, 0, 255 });
+        target.ClearDepth();
+        SubmitCommands(renderer, target, screen, resources, frame->buffer);
+    });
+    
+    auto hash = HashImage(target.image);
+    
+    // the same frame again with triangle setup reused between iterations, like frames from a still camera get drawn
+    TriangleSetupCache3D cache;
+    
+    auto cached = RunKernel(iterations, [&](BenchResult&)
+    {
+        target.ClearSurface({ 0, 0, 0, 255 });
+        target.ClearDepth();
+        SubmitCommands(renderer, target, screen, resources, frame->buffer, &cache);
+    });
+    
+    // reusing setup must not change a single pixel
+    auto cached_hash = HashImage(target.image);
+    
+    // the fast perspective divide is allowed to change pixels, so it reports how many it did instead
+    std::vector<Uint32> exact_pixels;
+    
+    for (int y = 0; y < target.image.height; ++y)
+    {
+        for (int x = 0; x < target.image.width; ++x)
+        {
+            exact_pixels.push_back(target.image.ReadPixel(x, y));
+        }
+    }
+    
+    renderer.SetPerspectiveDivide(PerspectiveDivide3D::Fast);
+    
+    auto fast = RunKernel(iterations, [&](BenchResult&)
+    {
+        target.ClearSurface({ 0, 0, 0, 255 });
+        target.ClearDepth();
+        SubmitCommands(renderer, target, screen, resources, frame->buffer);
+    });
+    
+    size_t changed = 0;
+    
+    for (int y = 0; y < target.image.height; ++y)
+    {
+        for (int x = 0; x < target.image.width; ++x)
+        {
+            changed += target.image.ReadPixel(x, y) != exact_pixels[(size_t)y * target.image.width + x];
+        }
+    }
+    
+    renderer.SetPerspectiveDivide(PerspectiveDivide3D::Exact);
+    
+    // and into a tiled target, which has to draw exactly the same pixels once they're copied back into its image
+    Image3D tiled_image(frame->width, frame->height, frame->format);
+    tiled_image.palette = target_image.palette;
+    Target tiled_target(tiled_image, TargetLayout3D::Tiled);
+    
+    auto tiled = RunKernel(iterations, [&](BenchResult&)
+    {
+        tiled_target.ClearSurface({ 0, 0, 0, 255 });
+        tiled_target.ClearDepth();
+        SubmitCommands(renderer, tiled_target, screen, resources, frame->buffer);
+        tiled_target.Detile();
+    });
+    
+    std::cout << "replaying " << filepath.string() << ": " << frame->width << "x" << frame->height << " ";
+    std::cout << GetPixelFormatName(frame->format) << ", " << frame->buffer.commands.size() << " commands, " << draws << " draws\n";
+    std::cout << std::fixed << std::setprecision(3) << result.seconds * 1000.0 << " ms per frame over " << iterations << " iterations\n";
+    std::cout << std::fixed << std::setprecision(3) << cached.seconds * 1000.0 << " ms per frame with triangle setup cached\n";
+    std::cout << std::fixed << std::setprecision(3) << fast.seconds * 1000.0 << " ms per frame with the fast perspective divide, ";
+    std::cout << changed << " of " << target.image.width * target.image.height << " pixels changed\n";
+    std::cout << std::fixed << std::setprecision(3) << tiled.seconds * 1000.0 << " ms per frame into a tiled target, detiled every frame\n";
+    std::cout << "image hash " << std::hex << hash << std::dec << "\n";
+    
+    if (cached_hash != hash)
+    {
+        std::cerr << "image hash changed with triangle setup cached\n";
+        return false;
+    }
+    
+    if (HashImage(tiled_image) != hash)
+    {
+        std::cerr << "image hash changed when drawn into a tiled target\n";
+        return false;
+    }
+    
+    return true;
+}
+
+
+// generates a stress scene from the given settings (like "triangles=100000") and reports how fast it gets drawn, first
+// by a single thread and then as a batch of frames with every worker thread drawing frames into a target of its own
+// (the last two lines are comma separated, so runs with different scene sizes and SMOLSOFT3D_THREADS can be charted)
+inline bool RunStressBenchmark(int iterations, const std::vector<std::string>& arguments)
+{
+    StressSettings3D settings;
+    
+    for (auto& argument: arguments)
+    {
+        if (!ParseStressSetting(settings, argument))
+        {
+            std::cerr << "unknown stress setting " << argument << "\n";
+            return false;
+        }
+    }
+    
+    auto generate_start = std::chrono::steady_clock::now();
+    auto scene = GenerateStressScene(settings);
+    auto generate_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - generate_start).count();
+    auto resources = scene.GetResources();
+    
+    Renderer3D renderer;
+    Target target = Image3D(settings.width, settings.height, PixelFormat3D::ARGB8888);
+    
+    // the scene's commands clear the target themselves
+    auto single = RunKernel(iterations, [&](BenchResult&)
+    {
+        SubmitCommands(renderer, target, scene.screen, resources, scene.buffer);
+    });
+    
+    // every thread creates its own target, so that it's first written (and placed) by the thread drawing to it
+    auto threads = GetWorkerCount();
+    auto batch_start = std::chrono::steady_clock::now();
+    
+    ParallelFor(threads, [&](size_t begin, size_t end)
+    {
+        for (auto job = begin; job < end; ++job)
+        {
+            Target job_target = Image3D(settings.width, settings.height, PixelFormat3D::ARGB8888);
+            
+            for (int i = 0; i < iterations; ++i)
+            {
+                SubmitCommands(renderer, job_target, scene.screen, resources, scene.buffer);
+            }
+        }
+    });
+    
+    auto batch_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - batch_start).count();
+    auto batch_frames = (double)threads * iterations / batch_seconds;
+    
+    const char* order_names[] = { "front to back", "back to front", "random" };
+    
+    std::cout << "stress scene: " << scene.triangles << " triangles in " << scene.models.size() << " models drawn ";
+    std::cout << std::max<size_t>(1, settings.instances) << " times, " << settings.textures << " textures, edges ";
+    std::cout << std::fixed << std::setprecision(2) << settings.min_size * scene.size_scale << "-";
+    std::cout << settings.max_size * scene.size_scale << "px (";
+    std::cout << (settings.sizes == StressSizes3D::Uniform ? "uniform" : "log uniform");
+    
+    // triangles with too much area to cover the screen only as often as asked get scaled down to fit
+    if (scene.size_scale < 1.0)
+    { std::cout << ", scaled by " << std::setprecision(3) << scene.size_scale << " to fit the screen"; }
+    
+    std::cout << "), depth complexity " << std::setprecision(2) << scene.depth_complexity << " drawn ";
+    std::cout << order_names[(int)settings.order] << ", generated in " << std::setprecision(1) << generate_seconds * 1000.0 << " ms\n";
+    std::cout << std::setprecision(3) << single.seconds * 1000.0 << " ms per frame on a single thread, ";
+    std::cout << std::setprecision(2) << scene.triangles / single.seconds / 1e6 << " million triangles per second\n";
+    std::cout << threads << " threads drawing a frame each: " << std::setprecision(1) << batch_frames << " frames per second, ";
+    std::cout << std::setprecision(2) << scene.triangles * batch_frames / 1e6 << " million triangles per second, ";
+    std::cout << batch_frames * single.seconds << "x a single thread\n";
+    
+    std::cout << "csv,triangles,instances,textures,depth_complexity,order,threads,single_ms,batch_fps,batch_mtris_per_s\n";
+    std::cout << "csv," << scene.triangles << "," << std::max<size_t>(1, settings.instances) << "," << settings.textures << ",";
+    std::cout << scene.depth_complexity << "," << (int)settings.order << "," << threads << "," << std::setprecision(4);
+    std::cout << single.seconds * 1000.0 << "," << batch_frames << "," << scene.triangles * batch_frames / 1e6 << "\n";
+    
+    return true;
+}
+
+
+int main(int argc, char** argv)
+{
+    int iterations = 200;
+    
+    if (argc > 1)
+    { iterations = std::max(1, std::atoi(argv[1])); }
+    
+    // generated stress scenes get drawn instead of benchmarking kernels
+    if (argc > 2 && std::string(argv[2]) == "stress")
+    { return RunStressBenchmark(iterations, std::vector<std::string>(argv + 3, argv + argc)) ? 0 : 1; }
+    
+    // recorded frames get replayed instead of benchmarking kernels
+    if (argc > 2)
+    { return RunReplayBenchmark(iterations, argv[2]) ? 0 : 1; }
+    
+    // the exit code says whether every backend matched the scalar one, so this can double as a check
+    auto matched = RunKernelBenchmarks(iterations);
+    RunPlacementBenchmark(iterations);
+    
+    return matched ? 0 : 1;
+}
@@ -0,0 +1,268 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+#include <glm/glm.hpp>
+
+
+// an axis-aligned bounding box in 3D space (empty by default)
+struct AABB3D
+{
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+    
+    // grows this box so that it contains the given point
+    inline void Grow(const glm::vec3& point)
+    {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+    
+    // grows this box so that it contains the given box
+    inline void Grow(const AABB3D& box)
+    {
+        min = glm::min(min, box.min);
+        max = glm::max(max, box.max);
+    }
+    
+    // whether this box contains nothing at all
+    inline bool IsEmpty() const
+    {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+    
+    // the point in the middle of this box
+    inline glm::vec3 Center() const
+    {
+        return (min + max) * 0.5f;
+    }
+    
+    // surface area of this box, which is proportional to the odds of a random ray hitting it
+    inline float Area() const
+    {
+        if (IsEmpty())
+        { return 0.0f; }
+        
+        auto size = max - min;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+};
+
+
+// a single node of a bounding volume hierarchy
+// (leaves have a non-zero count of primitives starting at first, other nodes have their children at first and first + 1)
+struct BVHNode3D
+{
+    AABB3D bounds;
+    uint32_t first = 0;
+    uint32_t count = 0;
+    
+    // whether this node contains primitives rather than child nodes
+    inline bool IsLeaf() const
+    {
+        return count > 0;
+    }
+};
+
+
+// a bounding volume hierarchy over a list of primitives, with node 0 as its root
+struct BVH3D
+{
+    std::vector<BVHNode3D> nodes;
+    std::vector<uint32_t> indices;
+    
+    // whether this hierarchy contains no primitives at all
+    inline bool IsEmpty() const
+    {
+        return nodes.empty();
+    }
+    
+    // bounds of every primitive contained in this hierarchy
+    inline AABB3D Bounds() const
+    {
+        return nodes.empty() ? AABB3D{} : nodes[0].bounds;
+    }
+};
+
+
+// how deep BuildBVH lets trees get (primitives can't be split more than 32 times in half), so that walking them only
+// needs a fixed size stack of max_bvh_depth + 1 nodes
+constexpr uint32_t max_bvh_depth = 80;
+
+
+// builds a bounding volume hierarchy over the given primitive bounds using the binned surface area heuristic
+inline BVH3D BuildBVH(const std::vector<AABB3D>& primitives)
+{
+    // number of buckets primitives get sorted into when looking for a split
+    constexpr int bin_count = 12;
+    
+    // nodes with this many primitives or less are never split
+    constexpr uint32_t min_leaf_size = 2;
+    
+    // nodes with more primitives than this are always split, even if the heuristic says otherwise
+    constexpr uint32_t max_leaf_size = 8;
+    
+    // nodes deeper than this are split down the middle instead of by the heuristic, which can peel off one primitive
+    // per level and build trees as deep as they have primitives, so that trees never get deeper than max_bvh_depth
+    constexpr uint32_t max_heuristic_depth = max_bvh_depth - 32;
+    
+    BVH3D bvh;
+    
+    if (primitives.empty())
+    { return bvh; }
+    
+    auto primitive_count = (uint32_t)primitives.size();
+    
+    // every primitive is sorted by its center
+    std::vector<glm::vec3> centers(primitive_count);
+    
+    for (uint32_t p = 0; p < primitive_count; ++p)
+    {
+        centers[p] = primitives[p].Center();
+    }
+    
+    bvh.indices.resize(primitive_count);
+    std::iota(bvh.indices.begin(), bvh.indices.end(), 0u);
+    
+    // a binary tree never has more than 2n - 1 nodes
+    bvh.nodes.reserve(2 * primitive_count - 1);
+    bvh.nodes.push_back(BVHNode3D{ AABB3D{}, 0, primitive_count });
+    
+    // nodes left to process, along with their depth
+    std::vector<std::pair<uint32_t, uint32_t>> stack{ { 0, 0 } };
+    
+    while (!stack.empty())
+    {
+        auto [node_i, depth] = stack.back();
+        stack.pop_back();
+        
+        auto first = bvh.nodes[node_i].first;
+        auto count = bvh.nodes[node_i].count;
+        auto begin = bvh.indices.begin() + first;
+        auto end = begin + count;
+        
+        // find the bounds of this node and of the centers it contains
+        AABB3D bounds;
+        AABB3D center_bounds;
+        
+        for (auto it = begin; it != end; ++it)
+        {
+            bounds.Grow(primitives[*it]);
+            center_bounds.Grow(centers[*it]);
+        }
+        
+        bvh.nodes[node_i].bounds = bounds;
+        
+        if (count <= min_leaf_size)
+        { continue; }
+        
+        // look for the cheapest split across every axis (the cost of a leaf is its area times its primitive count,
+        // and we count the traversal of a split as one extra primitive test)
+        auto area = bounds.Area();
+        auto best_cost = area * (count - 1);
+        auto best_axis = -1;
+        auto best_bin = 0;
+        
+        for (int axis = 0; axis < 3 && depth < max_heuristic_depth; ++axis)
+        {
+            auto lo = center_bounds.min[axis];
+            auto extent = center_bounds.max[axis] - lo;
+            
+            if (extent <= 0.0f)
+            { continue; }
+            
+            // sort primitives into bins
+            std::array<AABB3D, bin_count> bin_bounds;
+            std::array<uint32_t, bin_count> bin_sizes{};
+            
+            for (auto it = begin; it != end; ++it)
+            {
+                auto b = std::min(bin_count - 1, (int)((centers[*it][axis] - lo) / extent * bin_count));
+                bin_bounds[b].Grow(primitives[*it]);
+                bin_sizes[b] += 1;
+            }
+            
+            // sweep bins from the left and from the right to find the cost of splitting after each of them
+            std::array<float, bin_count - 1> left_costs;
+            std::array<float, bin_count - 1> right_costs;
+            
+            AABB3D left_bounds;
+            AABB3D right_bounds;
+            uint32_t left_size = 0;
+            uint32_t right_size = 0;
+            
+            for (int b = 0; b < bin_count - 1; ++b)
+            {
+                left_bounds.Grow(bin_bounds[b]);
+                left_size += bin_sizes[b];
+                left_costs[b] = left_bounds.Area() * left_size;
+                
+                right_bounds.Grow(bin_bounds[bin_count - 1 - b]);
+                right_size += bin_sizes[bin_count - 1 - b];
+                right_costs[bin_count - 2 - b] = right_bounds.Area() * right_size;
+            }
+            
+            for (int b = 0; b < bin_count - 1; ++b)
+            {
+                if (auto cost = left_costs[b] + right_costs[b]; cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = b;
+                }
+            }
+        }
+        
+        // partition primitives on either side of the chosen split
+        auto middle = begin;
+        
+        if (best_axis >= 0)
+        {
+            auto lo = center_bounds.min[best_axis];
+            auto extent = center_bounds.max[best_axis] - lo;
+            
+            middle = std::partition(begin, end, [&](uint32_t p)
+            {
+                return std::min(bin_count - 1, (int)((centers[p][best_axis] - lo) / extent * bin_count)) <= best_bin;
+            });
+        }
+        else if (count > max_leaf_size)
+        {
+            // the heuristic would rather keep this node whole, but it is too big, so split it down the middle of its longest axis
+            auto size = center_bounds.max - center_bounds.min;
+            auto axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+            
+            middle = begin + count / 2;
+            std::nth_element(begin, middle, end, [&](uint32_t a, uint32_t b)
+            {
+                return centers[a][axis] < centers[b][axis];
+            });
+        }
+        else
+        { continue; }
+        
+        auto left_count = (uint32_t)(middle - begin);
+        
+        if (left_count == 0 || left_count == count)
+        { continue; }
+        
+        // turn this node into a branch and process both of its children
+        auto child_i = (uint32_t)bvh.nodes.size();
+        
+        bvh.nodes.push_back(BVHNode3D{ AABB3D{}, first, left_count });
+        bvh.nodes.push_back(BVHNode3D{ AABB3D{}, first + left_count, count - left_count });
+        
+        bvh.nodes[node_i].first = child_i;
+        bvh.nodes[node_i].count = 0;
+        
+        stack.push_back({ child_i, depth + 1 });
+        stack.push_back({ child_i + 1, depth + 1 });
+    }
+    
+    return bvh;
+}
\ No newline at end of file
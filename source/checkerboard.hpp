@@ -0,0 +1,151 @@
+#pragma once
+#include <array>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "color.hpp"
+#include "image.hpp"
+#include "renderer.hpp"
+
+
+// fills in the pixels a target skipped when drawing only half of them, using the pixels drawn around them and the
+// previous frame, which gives a sharper result than rendering at half the resolution for about the same cost
+struct CheckerboardResolver3D
+{
+    // the previous resolved frame
+    std::vector<Uint32> history;
+    Uint32 frame = 0;
+    
+    // sets up the target to draw the half of its pixels whose turn it is this frame
+    inline void Begin(Target& target, RenderPattern pattern)
+    {
+        target.pattern = pattern;
+        target.pattern_phase = frame & 1;
+    }
+    
+    // fills every pixel the target skipped this frame, remembers the result for next time, and draws every pixel again
+    inline void Resolve(Target& target)
+    {
+        auto& image = target.image;
+        auto width = image.width;
+        auto height = image.height;
+        
+        // only 32 bit images are supported, and there is nothing to fill when every pixel was drawn
+        if (image.GetBytesPerPixel() != 4 || target.pattern == RenderPattern::Full)
+        {
+            End(target);
+            return;
+        }
+        
+        auto has_history = history.size() == (size_t)(width * height);
+        auto checkerboard = target.pattern == RenderPattern::Checkerboard;
+        
+        for (int y = 0; y < height; ++y)
+        {
+            // interlaced rows are either entirely drawn or entirely skipped
+            if (!checkerboard && target.IsInPattern(0, y))
+            { continue; }
+            
+            auto row = image.GetPixelRow(y);
+            auto row_above = image.GetPixelRow(std::max(y - 1, 0));
+            auto row_below = image.GetPixelRow(std::min(y + 1, height - 1));
+            
+            // only visit skipped pixels, which are every other one in checkerboard mode
+            auto first = checkerboard && target.IsInPattern(0, y) ? 1 : 0;
+            auto step = checkerboard ? 2 : 1;
+            
+            for (int x = first; x < width; x += step)
+            {
+                // gather neighbors that were drawn this frame (left and right are only drawn in checkerboard mode)
+                std::array<Uint32, 4> neighbors;
+                size_t count = 0;
+                
+                if (y > 0)
+                { neighbors[count++] = row_above[x]; }
+                
+                if (y < height - 1)
+                { neighbors[count++] = row_below[x]; }
+                
+                if (checkerboard)
+                {
+                    if (x > 0)
+                    { neighbors[count++] = row[x - 1]; }
+                    
+                    if (x < width - 1)
+                    { neighbors[count++] = row[x + 1]; }
+                }
+                
+                if (count == 0)
+                { continue; }
+                
+                // the previous frame's pixel is kept as long as it fits in with its neighbors, which keeps still areas
+                // at full resolution while stopping moving ones from leaving trails behind
+                row[x] = ResolvePixel(neighbors.data(), count, has_history ? history[y * width + x] : 0, has_history);
+            }
+        }
+        
+        End(target);
+    }
+    
+    // works out a skipped pixel's color from its drawn neighbors and its color last frame (one channel at a time)
+    inline static Uint32 ResolvePixel(const Uint32* neighbors, size_t count, Uint32 previous, bool has_previous)
+    {
+        // dividing by a multiplication is much cheaper than four integer divisions
+        Uint32 result = 0;
+        Uint32 inv_count = (65536 + (Uint32)count - 1) / (Uint32)count;
+        
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            Uint32 lo = 255;
+            Uint32 hi = 0;
+            Uint32 sum = 0;
+            
+            for (size_t n = 0; n < count; ++n)
+            {
+                Uint32 channel = (neighbors[n] >> shift) & 0xFF;
+                lo = channel < lo ? channel : lo;
+                hi = channel > hi ? channel : hi;
+                sum += channel;
+            }
+            
+            Uint32 channel;
+            
+            if (has_previous)
+            {
+                channel = (previous >> shift) & 0xFF;
+                channel = channel < lo ? lo : (channel > hi ? hi : channel);
+            }
+            else
+            {
+                channel = std::min((sum * inv_count) >> 16, 255u);
+            }
+            
+            result |= channel << shift;
+        }
+        
+        return result;
+    }
+    
+    // remembers the resolved frame and switches to the other half of the pixels for the next one
+    inline void End(Target& target)
+    {
+        auto& image = target.image;
+        
+        target.pattern = RenderPattern::Full;
+        frame += 1;
+        
+        if (image.GetBytesPerPixel() != 4)
+        {
+            history.clear();
+            return;
+        }
+        
+        history.resize(image.width * image.height);
+        
+        for (int y = 0; y < image.height; ++y)
+        {
+            std::memcpy(&history[y * image.width], image.GetPixelRow(y), image.width * sizeof(Uint32));
+        }
+    }
+};
\ No newline at end of file
@@ -0,0 +1,242 @@
+#pragma once
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "bvh.hpp"
+#include "renderer.hpp"
+
+
+// a uniform grid of world space triangles, used to quickly find the few triangles near a given point
+// (only the cells that actually contain triangles take up memory, so the grid can be as big as needed)
+struct CollisionGrid3D
+{
+    float cell_size;
+    std::vector<std::array<glm::vec3, 3>> triangles;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+    
+    // constructs an empty grid with cells of the given size (ideally a bit bigger than whatever moves through it)
+    inline CollisionGrid3D(float cell_size = 2.0f):
+        cell_size(cell_size)
+    {}
+    
+    // packs the coordinates of a cell into a single key (21 bits per axis, which is plenty for a level)
+    inline static uint64_t CellKey(int x, int y, int z)
+    {
+        constexpr uint64_t mask = (1 << 21) - 1;
+        return ((uint64_t)x & mask) | (((uint64_t)y & mask) << 21) | (((uint64_t)z & mask) << 42);
+    }
+    
+    // finds the coordinates of the cell containing the given point
+    inline glm::ivec3 CellOf(const glm::vec3& pos) const
+    {
+        return glm::ivec3(glm::floor(pos / cell_size));
+    }
+    
+    // adds the given model's triangles to the grid, as they would be placed by the given transform
+    inline void AddModel(const Model3D& model, const glm::mat4& transform = glm::mat4(1.0f))
+    {
+        triangles.reserve(triangles.size() + model.triangles.size());
+        
+        for (auto& triangle: model.triangles)
+        {
+            auto& verts = triangle.vertices;
+            
+            AddTriangle({
+                glm::vec3(transform * verts[0].pos),
+                glm::vec3(transform * verts[1].pos),
+                glm::vec3(transform * verts[2].pos),
+            });
+        }
+    }
+    
+    // adds a single world space triangle to every cell its bounds overlap
+    inline void AddTriangle(const std::array<glm::vec3, 3>& triangle)
+    {
+        auto triangle_i = (uint32_t)triangles.size();
+        triangles.push_back(triangle);
+        
+        AABB3D bounds;
+        bounds.Grow(triangle[0]);
+        bounds.Grow(triangle[1]);
+        bounds.Grow(triangle[2]);
+        
+        auto lo = CellOf(bounds.min);
+        auto hi = CellOf(bounds.max);
+        
+        for (int z = lo.z; z <= hi.z; ++z)
+        for (int y = lo.y; y <= hi.y; ++y)
+        for (int x = lo.x; x <= hi.x; ++x)
+        {
+            cells[CellKey(x, y, z)].push_back(triangle_i);
+        }
+    }
+    
+    // removes every triangle from the grid
+    inline void Clear()
+    {
+        triangles.clear();
+        cells.clear();
+    }
+    
+    // finds the index of every triangle whose cells overlap the given box (each index is only listed once)
+    inline void Query(const AABB3D& box, std::vector<uint32_t>& out_triangles) const
+    {
+        out_triangles.clear();
+        
+        auto lo = CellOf(box.min);
+        auto hi = CellOf(box.max);
+        
+        for (int z = lo.z; z <= hi.z; ++z)
+        for (int y = lo.y; y <= hi.y; ++y)
+        for (int x = lo.x; x <= hi.x; ++x)
+        {
+            if (auto cell = cells.find(CellKey(x, y, z)); cell != cells.end())
+            {
+                out_triangles.insert(out_triangles.end(), cell->second.begin(), cell->second.end());
+            }
+        }
+        
+        // triangles spanning several cells show up once per cell
+        std::sort(out_triangles.begin(), out_triangles.end());
+        out_triangles.erase(std::unique(out_triangles.begin(), out_triangles.end()), out_triangles.end());
+    }
+};
+
+
+// finds the point on triangle abc that is closest to point p
+inline glm::vec3 ClosestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+    // this checks which voronoi region of the triangle p falls in, one vertex or edge at a time
+    auto ab = b - a;
+    auto ac = c - a;
+    auto ap = p - a;
+    
+    auto d1 = glm::dot(ab, ap);
+    auto d2 = glm::dot(ac, ap);
+    
+    if (d1 <= 0.0f && d2 <= 0.0f)
+    { return a; }
+    
+    auto bp = p - b;
+    auto d3 = glm::dot(ab, bp);
+    auto d4 = glm::dot(ac, bp);
+    
+    if (d3 >= 0.0f && d4 <= d3)
+    { return b; }
+    
+    auto vc = d1 * d4 - d3 * d2;
+    
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+    { return a + ab * (d1 / (d1 - d3)); }
+    
+    auto cp = p - c;
+    auto d5 = glm::dot(ab, cp);
+    auto d6 = glm::dot(ac, cp);
+    
+    if (d6 >= 0.0f && d5 <= d6)
+    { return c; }
+    
+    auto vb = d5 * d2 - d1 * d6;
+    
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+    { return a + ac * (d2 / (d2 - d6)); }
+    
+    auto va = d3 * d6 - d5 * d4;
+    
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+    { return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6))); }
+    
+    // p is above the face of the triangle
+    auto denom = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+
+// pushes a sphere out of every nearby triangle it overlaps, and returns where it ends up
+inline glm::vec3 ResolveSphere(const CollisionGrid3D& grid, glm::vec3 pos, float radius, std::vector<uint32_t>& scratch)
+{
+    // pushing out of one triangle can push us into another, so this takes a few passes in corners
+    constexpr int max_passes = 4;
+    
+    for (int pass = 0; pass < max_passes; ++pass)
+    {
+        AABB3D bounds{ pos - glm::vec3(radius), pos + glm::vec3(radius) };
+        grid.Query(bounds, scratch);
+        
+        bool moved = false;
+        
+        for (auto triangle_i: scratch)
+        {
+            auto& tri = grid.triangles[triangle_i];
+            auto closest = ClosestPointOnTriangle(pos, tri[0], tri[1], tri[2]);
+            auto offset = pos - closest;
+            auto dist_sq = glm::dot(offset, offset);
+            
+            // (written so that a NaN distance, which only degenerate triangles can produce, gets skipped too)
+            if (!(dist_sq < radius * radius))
+            { continue; }
+            
+            // a sphere centered right on the triangle gets pushed out along its normal, unless the triangle has no area
+            // and so no normal (it can't block anything then anyway)
+            auto dist = std::sqrt(dist_sq);
+            auto normal = offset / dist;
+            
+            if (dist <= 1e-6f)
+            {
+                auto cross = glm::cross(tri[1] - tri[0], tri[2] - tri[0]);
+                auto cross_length = glm::length(cross);
+                
+                if (cross_length <= 1e-12f)
+                { continue; }
+                
+                normal = cross / cross_length;
+            }
+            
+            pos = closest + normal * radius;
+            moved = true;
+        }
+        
+        if (!moved)
+        { break; }
+    }
+    
+    return pos;
+}
+
+
+// moves a sphere from start along the given motion, sliding along any triangles in the way, and returns where it ends up
+inline glm::vec3 SweepSphere(const CollisionGrid3D& grid, const glm::vec3& start, const glm::vec3& motion, float radius)
+{
+    // points can't collide with anything
+    if (!(radius > 0.0f))
+    { return start + motion; }
+    
+    // the motion is split into steps no longer than half the radius, so that the sphere can't tunnel through thin walls
+    // (up to a limit, so that tiny spheres making huge moves still fit the step count in an int)
+    auto length = glm::length(motion);
+    auto steps = (int)std::min(std::max(1.0f, std::ceil(length / (radius * 0.5f))), 65536.0f);
+    auto step = motion / (float)steps;
+    
+    std::vector<uint32_t> scratch;
+    auto pos = start;
+    
+    for (int s = 0; s < steps; ++s)
+    {
+        pos = ResolveSphere(grid, pos + step, radius, scratch);
+    }
+    
+    return pos;
+}
+
+
+// moves the camera like Camera3D::Move, except that it treats the camera as a sphere that collides with the grid's triangles
+inline void MoveCamera(Camera3D& camera, const CollisionGrid3D& grid, float radius, float advance, float strafe, float ascend)
+{
+    camera.pos = SweepSphere(grid, camera.pos, camera.GetMotion(advance, strafe, ascend), radius);
+}
\ No newline at end of file
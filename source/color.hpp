@@ -0,0 +1,73 @@
+#pragma once
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+
+// fixed size integer names used throughout the renderer (the same ones SDL uses, so both can be included together)
+using Uint8 = std::uint8_t;
+using Uint16 = std::uint16_t;
+using Uint32 = std::uint32_t;
+using Uint64 = std::uint64_t;
+
+
+// an 8 bit per channel color with alpha
+struct Color3D
+{
+    Uint8 r;
+    Uint8 g;
+    Uint8 b;
+    Uint8 a;
+};
+
+
+// lookup tables between 8 bit sRGB channels and 12 bit linear light ones, so that colors can be multiplied and averaged
+// the way light actually adds up without raising anything to a power per pixel
+// (12 bits keeps every 8 bit channel distinct in linear light, so converting there and back gives the same channel)
+struct SrgbTables3D
+{
+    // 8 bit sRGB channel to linear light, from 0 to 4095
+    std::array<Uint16, 256> to_linear;
+    
+    // linear light from 0 to 4095 to the closest 8 bit sRGB channel
+    std::array<Uint8, 4096> to_srgb;
+    
+    // builds both tables with the exact sRGB transfer functions
+    inline SrgbTables3D()
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            auto srgb = (double)i / 255.0;
+            auto linear = srgb <= 0.04045 ? srgb / 12.92 : std::pow((srgb + 0.055) / 1.055, 2.4);
+            to_linear[i] = (Uint16)std::lround(linear * 4095.0);
+        }
+        
+        for (int i = 0; i < 4096; ++i)
+        {
+            auto linear = (double)i / 4095.0;
+            auto srgb = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+            to_srgb[i] = (Uint8)std::lround(srgb * 255.0);
+        }
+    }
+    
+    // multiplies two sRGB channels in linear light, rounding a * b / 4095 to the nearest integer without dividing
+    inline Uint8 Modulate(Uint8 a, Uint8 b) const
+    {
+        Uint32 product = (Uint32)to_linear[a] * to_linear[b] + 2048;
+        return to_srgb[(product + (product >> 12)) >> 12];
+    }
+    
+    // averages four sRGB channels in linear light
+    inline Uint8 Average(Uint8 a, Uint8 b, Uint8 c, Uint8 d) const
+    {
+        return to_srgb[((Uint32)to_linear[a] + to_linear[b] + to_linear[c] + to_linear[d] + 2) >> 2];
+    }
+};
+
+
+// returns the sRGB lookup tables, which are built the first time they're needed
+inline const SrgbTables3D& GetSrgbTables()
+{
+    static const SrgbTables3D tables;
+    return tables;
+}
\ No newline at end of file
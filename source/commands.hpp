@@ -0,0 +1,495 @@
+#pragma once
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <optional>
+#include <string>
+#include <vector>
+namespace fs = std::filesystem;
+
+#include <glm/glm.hpp>
+
+#include "color.hpp"
+#include "image.hpp"
+#include "renderer.hpp"
+#include "setup.hpp"
+
+
+// the kinds of commands a command buffer can hold
+enum class CommandType3D: Uint8
+{
+    // clears the target's image to a packed ARGB8888 color
+    ClearSurface,
+    
+    // clears the target's depth buffer
+    ClearDepth,
+    
+    // sets the camera used by subsequent draws (an index into the buffer's cameras)
+    SetCamera,
+    
+    // sets the image sampled by subsequent draws (a resource id, or none for untextured draws)
+    SetSampler,
+    
+    // sets the shading rate of subsequent draws
+    SetShadingRate,
+    
+    // sets the transform of subsequent draws (an index into the buffer's transforms)
+    SetTransform,
+    
+    // draws a model (a resource id)
+    DrawModel,
+    
+    // puts every piece of state back to how submitting starts (untextured, no transform or camera, and the renderer's
+    // shading rate), which every merged buffer begins with
+    Reset,
+};
+
+
+// a single recorded command along with its only argument, which keeps buffers at 8 bytes per command
+struct Command3D
+{
+    CommandType3D type;
+    Uint32 arg;
+};
+
+
+// the models and images commands refer to by id (ids are the order resources were added in, so recorded frames can be
+// replayed by adding the same resources in the same order)
+struct CommandResources3D
+{
+    std::vector<const Model3D*> models;
+    std::vector<const Image3D*> images;
+    
+    // where each resource came from, which recorded frames use to find them again
+    std::vector<std::string> model_names;
+    std::vector<std::string> image_names;
+    
+    // adds a model that commands can draw and returns its id (the model must outlive every buffer that uses it)
+    inline Uint32 AddModel(const Model3D& model, const std::string& name = "")
+    {
+        models.push_back(&model);
+        model_names.push_back(name);
+        return (Uint32)(models.size() - 1);
+    }
+    
+    // adds an image that commands can sample and returns its id (the image must outlive every buffer that uses it)
+    inline Uint32 AddImage(const Image3D& image, const std::string& name = "")
+    {
+        images.push_back(&image);
+        image_names.push_back(name);
+        return (Uint32)(images.size() - 1);
+    }
+};
+
+
+// a list of draws and state changes recorded ahead of time and executed later by SubmitCommands
+// (recording only appends to the buffer's own vectors, so every thread can safely record a buffer of its own)
+struct CommandBuffer3D
+{
+    // argument meaning "no resource", for untextured draws
+    static constexpr Uint32 none = 0xFFFFFFFF;
+    
+    // buffers with lower layers get executed first when merged, and buffers on the same layer keep their order
+    int layer = 0;
+    
+    std::vector<Command3D> commands;
+    std::vector<glm::mat4> transforms;
+    std::vector<Camera3D> cameras;
+    
+    // last recorded state, so that setting it again doesn't record anything
+    Uint32 recorded_sampler = none;
+    Uint32 recorded_transform = none;
+    
+    // removes every recorded command so the buffer can be reused without reallocating
+    inline void Clear()
+    {
+        commands.clear();
+        transforms.clear();
+        cameras.clear();
+        recorded_sampler = none;
+        recorded_transform = none;
+    }
+    
+    // records clearing the target's image with the given color
+    inline void ClearSurface(const Color3D& color)
+    {
+        commands.push_back({ CommandType3D::ClearSurface, PackARGB8888(color) });
+    }
+    
+    // records clearing the target's depth buffer
+    inline void ClearDepth()
+    {
+        commands.push_back({ CommandType3D::ClearDepth, 0 });
+    }
+    
+    // records the camera subsequent draws are seen from
+    inline void SetCamera(const Camera3D& camera)
+    {
+        commands.push_back({ CommandType3D::SetCamera, (Uint32)cameras.size() });
+        cameras.push_back(camera);
+    }
+    
+    // records which image subsequent draws sample from, by resource id (none draws untextured)
+    inline void SetSampler(Uint32 image)
+    {
+        if (image == recorded_sampler)
+        { return; }
+        
+        commands.push_back({ CommandType3D::SetSampler, image });
+        recorded_sampler = image;
+    }
+    
+    // records the shading rate of subsequent draws
+    inline void SetShadingRate(ShadingRate rate)
+    {
+        commands.push_back({ CommandType3D::SetShadingRate, (Uint32)rate });
+    }
+    
+    // records the transform of subsequent draws
+    inline void SetTransform(const glm::mat4& transform)
+    {
+        if (recorded_transform != none && transforms[recorded_transform] == transform)
+        { return; }
+        
+        recorded_transform = (Uint32)transforms.size();
+        commands.push_back({ CommandType3D::SetTransform, recorded_transform });
+        transforms.push_back(transform);
+    }
+    
+    // records drawing a model by resource id, with the current transform
+    inline void DrawModel(Uint32 model)
+    {
+        commands.push_back({ CommandType3D::DrawModel, model });
+    }
+    
+    // records drawing a model by resource id, with the given transform
+    inline void DrawModel(Uint32 model, const glm::mat4& transform)
+    {
+        SetTransform(transform);
+        DrawModel(model);
+    }
+    
+    // appends another buffer's commands, starting from reset state so that neither buffer's state leaks into the other
+    inline void Append(const CommandBuffer3D& other)
+    {
+        auto transform_offset = (Uint32)transforms.size();
+        auto camera_offset = (Uint32)cameras.size();
+        
+        commands.push_back({ CommandType3D::Reset, 0 });
+        
+        for (auto command: other.commands)
+        {
+            if (command.type == CommandType3D::SetTransform)
+            { command.arg += transform_offset; }
+            else if (command.type == CommandType3D::SetCamera)
+            { command.arg += camera_offset; }
+            
+            commands.push_back(command);
+        }
+        
+        transforms.insert(transforms.end(), other.transforms.begin(), other.transforms.end());
+        cameras.insert(cameras.end(), other.cameras.begin(), other.cameras.end());
+        
+        recorded_sampler = other.recorded_sampler;
+        recorded_transform = other.recorded_transform != none ? other.recorded_transform + transform_offset : none;
+    }
+};
+
+
+// merges buffers recorded separately (for example by different threads) into a single one, ordered by layer
+inline CommandBuffer3D MergeCommandBuffers(const std::vector<const CommandBuffer3D*>& buffers)
+{
+    auto ordered = buffers;
+    std::stable_sort(ordered.begin(), ordered.end(), [](auto a, auto b) { return a->layer < b->layer; });
+    
+    CommandBuffer3D merged;
+    
+    for (auto buffer: ordered)
+    {
+        merged.Append(*buffer);
+    }
+    
+    return merged;
+}
+
+
+// executes every command in the given buffer, drawing to the given target
+// (buffers start out untextured at the renderer's shading rate and linear light setting, draws before the buffer's
+// first SetCamera are skipped, as are commands referring to resources that don't exist, and since the pipeline state
+// is tracked here rather than in the renderer, several threads can submit to separate targets at once)
+// (models get drawn with triangles set up by the given cache, if any, which makes frames from a still camera cheaper)
+inline void SubmitCommands(const Renderer3D& renderer, Target& target, const Screen& screen, const CommandResources3D& resources, const CommandBuffer3D& buffer, TriangleSetupCache3D* cache = nullptr)
+{
+    PipelineState3D state(nullptr, renderer.state.shading_rate, renderer.state.linear_light);
+    const Camera3D* camera = nullptr;
+    glm::mat4 transform(1.0f);
+    
+    for (auto& command: buffer.commands)
+    {
+        switch (command.type)
+        {
+            case CommandType3D::ClearSurface:
+                target.ClearSurface(UnpackARGB8888(command.arg));
+                break;
+            
+            case CommandType3D::ClearDepth:
+                target.ClearDepth();
+                break;
+            
+            case CommandType3D::SetCamera:
+                camera = &buffer.cameras[command.arg];
+                break;
+            
+            case CommandType3D::SetSampler:
+                state = PipelineState3D(command.arg < resources.images.size() ? resources.images[command.arg] : nullptr, state.shading_rate, state.linear_light);
+                break;
+            
+            case CommandType3D::SetShadingRate:
+                state.shading_rate = (ShadingRate)command.arg;
+                break;
+            
+            case CommandType3D::SetTransform:
+                transform = buffer.transforms[command.arg];
+                break;
+            
+            case CommandType3D::DrawModel:
+                if (camera == nullptr || command.arg >= resources.models.size())
+                { break; }
+                
+                if (cache != nullptr)
+                { cache->Blit3DModel(renderer, target, state, *camera, screen, *resources.models[command.arg], transform); }
+                else
+                { renderer.Blit3DModel(target, state, *camera, screen, *resources.models[command.arg], transform); }
+                break;
+            
+            case CommandType3D::Reset:
+                state = PipelineState3D(nullptr, renderer.state.shading_rate, renderer.state.linear_light);
+                camera = nullptr;
+                transform = glm::mat4(1.0f);
+                break;
+        }
+    }
+}
+
+
+// merges the given buffers and executes the result
+inline void SubmitCommands(const Renderer3D& renderer, Target& target, const Screen& screen, const CommandResources3D& resources, const std::vector<const CommandBuffer3D*>& buffers, TriangleSetupCache3D* cache = nullptr)
+{
+    SubmitCommands(renderer, target, screen, resources, MergeCommandBuffers(buffers), cache);
+}
+
+
+// an image that was sampled by a recorded frame (only its size and format are kept, not its pixels)
+struct RecordedImage3D
+{
+    int width;
+    int height;
+    PixelFormat3D format;
+    std::string name;
+};
+
+
+// everything needed to replay a frame recorded by SaveCommands
+struct RecordedFrame3D
+{
+    int width = 0;
+    int height = 0;
+    PixelFormat3D format = PixelFormat3D::ARGB8888;
+    float fov = 60.0f;
+    
+    std::vector<std::string> model_names;
+    std::vector<RecordedImage3D> images;
+    CommandBuffer3D buffer;
+};
+
+
+// saves a command buffer, along with the target it was drawn to and the resources it used, to a text file that
+// LoadCommands can read back (models are saved by name, and images only by name, size and format)
+inline bool SaveCommands(const fs::path& filepath, const CommandBuffer3D& buffer, const CommandResources3D& resources, const Image3D& target, const Screen& screen)
+{
+    if (std::ofstream file(filepath); file)
+    {
+        // floats are written with every digit they need, so replaying a frame draws exactly the same pixels
+        file.precision(std::numeric_limits<float>::max_digits10);
+        
+        // write the target and the resources
+        file << "frame " << target.width << " " << target.height << " " << GetPixelFormatName(target.format) << " " << screen.fov << "\n";
+        
+        for (auto& name: resources.model_names)
+        {
+            file << "model " << name << "\n";
+        }
+        
+        for (size_t i = 0; i < resources.images.size(); ++i)
+        {
+            auto image = resources.images[i];
+            file << "image " << image->width << " " << image->height << " " << GetPixelFormatName(image->format) << " " << resources.image_names[i] << "\n";
+        }
+        
+        // write each command along with its argument
+        for (auto& command: buffer.commands)
+        {
+            switch (command.type)
+            {
+                case CommandType3D::ClearSurface:
+                {
+                    auto color = UnpackARGB8888(command.arg);
+                    file << "clear " << (int)color.r << " " << (int)color.g << " " << (int)color.b << " " << (int)color.a << "\n";
+                    break;
+                }
+                
+                case CommandType3D::ClearDepth:
+                    file << "depth\n";
+                    break;
+                
+                case CommandType3D::SetCamera:
+                {
+                    auto& camera = buffer.cameras[command.arg];
+                    file << "camera " << camera.pos.x << " " << camera.pos.y << " " << camera.pos.z << " " << camera.pitch << " " << camera.yaw << "\n";
+                    break;
+                }
+                
+                case CommandType3D::SetSampler:
+                    file << "sampler " << (command.arg == CommandBuffer3D::none ? -1 : (long long)command.arg) << "\n";
+                    break;
+                
+                case CommandType3D::SetShadingRate:
+                    file << "rate " << command.arg << "\n";
+                    break;
+                
+                case CommandType3D::SetTransform:
+                {
+                    auto& transform = buffer.transforms[command.arg];
+                    file << "transform";
+                    
+                    for (int c = 0; c < 4; ++c)
+                    for (int r = 0; r < 4; ++r)
+                    {
+                        file << " " << transform[c][r];
+                    }
+                    
+                    file << "\n";
+                    break;
+                }
+                
+                case CommandType3D::DrawModel:
+                    file << "draw " << command.arg << "\n";
+                    break;
+                
+                case CommandType3D::Reset:
+                    file << "reset\n";
+                    break;
+            }
+        }
+        
+        return (bool)file;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+
+// loads a frame saved by SaveCommands (lines starting with an unknown word are skipped, and files with lines that
+// don't parse, like numbers that aren't numbers or commands cut off at the end, fail to load)
+inline std::optional<RecordedFrame3D> LoadCommands(const fs::path& filepath)
+{
+    if (std::ifstream file(filepath); file)
+    {
+        RecordedFrame3D frame;
+        auto& buffer = frame.buffer;
+        std::string word;
+        
+        while (file >> word)
+        {
+            if (word == "frame")
+            {
+                std::string format;
+                file >> frame.width >> frame.height >> format >> frame.fov;
+                frame.format = ParsePixelFormat(format);
+            }
+            else if (word == "model")
+            {
+                std::string name;
+                std::getline(file >> std::ws, name);
+                frame.model_names.push_back(name);
+            }
+            else if (word == "image")
+            {
+                RecordedImage3D image;
+                std::string format;
+                file >> image.width >> image.height >> format;
+                std::getline(file >> std::ws, image.name);
+                image.format = ParsePixelFormat(format);
+                frame.images.push_back(image);
+            }
+            else if (word == "clear")
+            {
+                int r, g, b, a;
+                file >> r >> g >> b >> a;
+                buffer.ClearSurface(Color3D{ (Uint8)r, (Uint8)g, (Uint8)b, (Uint8)a });
+            }
+            else if (word == "depth")
+            {
+                buffer.ClearDepth();
+            }
+            else if (word == "camera")
+            {
+                Camera3D camera;
+                file >> camera.pos.x >> camera.pos.y >> camera.pos.z >> camera.pitch >> camera.yaw;
+                buffer.SetCamera(camera);
+            }
+            else if (word == "sampler")
+            {
+                long long image;
+                file >> image;
+                buffer.commands.push_back({ CommandType3D::SetSampler, image < 0 ? CommandBuffer3D::none : (Uint32)image });
+            }
+            else if (word == "rate")
+            {
+                Uint32 rate;
+                file >> rate;
+                buffer.SetShadingRate((ShadingRate)rate);
+            }
+            else if (word == "transform")
+            {
+                glm::mat4 transform;
+                
+                for (int c = 0; c < 4; ++c)
+                for (int r = 0; r < 4; ++r)
+                {
+                    file >> transform[c][r];
+                }
+                
+                buffer.commands.push_back({ CommandType3D::SetTransform, (Uint32)buffer.transforms.size() });
+                buffer.transforms.push_back(transform);
+            }
+            else if (word == "draw")
+            {
+                Uint32 model;
+                file >> model;
+                buffer.DrawModel(model);
+            }
+            else if (word == "reset")
+            {
+                buffer.commands.push_back({ CommandType3D::Reset, 0 });
+            }
+            else
+            {
+                std::getline(file, word);
+            }
+            
+            // a line that didn't parse means the file is damaged, and replaying what's left would draw the wrong frame
+            if (file.fail())
+            { return std::nullopt; }
+        }
+        
+        return frame;
+    }
+    else
+    {
+        return std::nullopt;
+    }
+}
\ No newline at end of file
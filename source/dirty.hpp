@@ -0,0 +1,224 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "color.hpp"
+#include "renderer.hpp"
+#include "setup.hpp"
+
+
+// finds every tile of the given target the given instance could draw to (conservatively, from its model's bounds)
+inline TileRect3D GetInstanceTiles(const Target& target, const Camera3D& camera, const Screen& screen, const Instance3D& instance)
+{
+    auto all_tiles = TileRect3D{ 0, 0, target.GetTileColumns() - 1, target.GetTileRows() - 1 };
+    
+    if (instance.model == nullptr || instance.model->triangles.empty())
+    { return TileRect3D{}; }
+    
+    // models built without a hierarchy get their bounds from their triangles instead
+    auto bounds = instance.model->bvh.Bounds();
+    
+    if (instance.model->bvh.IsEmpty())
+    {
+        for (auto& triangle: instance.model->triangles)
+        {
+            for (auto& vertex: triangle.vertices)
+            { bounds.Grow(glm::vec3(vertex.pos)); }
+        }
+    }
+    
+    auto min = glm::vec2(std::numeric_limits<float>::max());
+    auto max = glm::vec2(std::numeric_limits<float>::lowest());
+    
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        auto pos = glm::vec3(
+            (corner & 1) != 0 ? bounds.max.x : bounds.min.x,
+            (corner & 2) != 0 ? bounds.max.y : bounds.min.y,
+            (corner & 4) != 0 ? bounds.max.z : bounds.min.z
+        );
+        
+        auto view_pos = TranslateToView(glm::vec3(instance.transform * glm::vec4(pos, 1.0f)), camera);
+        
+        // corners behind the near plane get clipped, and what's left of the model could end up anywhere on screen
+        if (view_pos.z < 0.1f)
+        { return all_tiles; }
+        
+        auto screen_pos = glm::vec2(ScaleToScreen(view_pos, screen));
+        min = glm::min(min, screen_pos);
+        max = glm::max(max, screen_pos);
+    }
+    
+    auto rect = GetTileRect(min, max);
+    
+    return TileRect3D{
+        std::max(rect.x1, all_tiles.x1),
+        std::max(rect.y1, all_tiles.y1),
+        std::min(rect.x2, all_tiles.x2),
+        std::min(rect.y2, all_tiles.y2),
+    };
+}
+
+
+// keeps the previous frame's pixels and only redraws tiles that an instance moved into or out of since then, so that
+// frames where nothing changed cost next to nothing (the camera moving, or anything else drawing to the target, means
+// everything gets redrawn)
+struct DirtyTileTracker3D
+{
+    // if more than this fraction of tiles needs to be redrawn, the whole target is redrawn instead
+    float max_dirty_ratio = 0.75f;
+    
+    // the instances drawn last frame, the tiles each of them covered, and what they were drawn with
+    std::vector<Instance3D> instances;
+    std::vector<TileRect3D> tiles;
+    Camera3D camera{ glm::vec3(0.0f), 0.0f, 0.0f };
+    Screen screen{ 0.0f, 0.0f, 0.0f };
+    const Uint8* pixels = nullptr;
+    bool has_history = false;
+    
+    // which instances of the current frame touch a tile that needs to be redrawn
+    std::vector<Uint8> needs_draw;
+    
+    // triangles set up by previous frames, which stay valid for as long as the camera doesn't move
+    TriangleSetupCache3D setup_cache;
+    
+    // forgets the previous frame, so that the next one gets drawn in full (do this after drawing to the target some other way)
+    inline void Reset()
+    {
+        has_history = false;
+    }
+    
+    // compares the given instances with last frame's, clears the tiles that changed, and masks the target so that only
+    // those can be drawn to (returns how many tiles need to be drawn)
+    inline size_t Begin(Target& target, const Camera3D& camera, const Screen& screen, const std::vector<Instance3D>& instances, const Color3D& clear_color)
+    {
+        auto tile_columns = target.GetTileColumns();
+        auto tile_count = (size_t)(tile_columns * target.GetTileRows());
+        
+        std::vector<TileRect3D> tiles(instances.size());
+        
+        for (size_t i = 0; i < instances.size(); ++i)
+        {
+            tiles[i] = GetInstanceTiles(target, camera, screen, instances[i]);
+        }
+        
+        // the previous frame can only be kept if it's still in the target and was seen from the same place
+        auto same_view =
+            has_history && target.image.pixels == pixels && target.pattern == RenderPattern::Full &&
+            camera == this->camera && screen == this->screen;
+        
+        // tiles covered by instances that appeared, disappeared or changed, both where they were and where they are
+        std::vector<Uint8> mask(tile_count, 0);
+        size_t dirty_count = 0;
+        
+        auto mark = [&](const TileRect3D& rect)
+        {
+            for (int ty = rect.y1; ty <= rect.y2; ++ty)
+            {
+                for (int tx = rect.x1; tx <= rect.x2; ++tx)
+                {
+                    dirty_count += mask[ty * tile_columns + tx] == 0;
+                    mask[ty * tile_columns + tx] = 1;
+                }
+            }
+        };
+        
+        for (size_t i = 0; same_view && i < std::max(instances.size(), this->instances.size()); ++i)
+        {
+            if (i >= instances.size())
+            { mark(this->tiles[i]); }
+            else if (i >= this->instances.size())
+            { mark(tiles[i]); }
+            else if (!(instances[i] == this->instances[i]))
+            {
+                mark(this->tiles[i]);
+                mark(tiles[i]);
+            }
+        }
+        
+        this->instances = instances;
+        this->tiles = tiles;
+        this->camera = camera;
+        this->screen = screen;
+        pixels = target.image.pixels;
+        has_history = true;
+        
+        // when most of the screen changed, drawing everything is simpler and not much slower
+        if (!same_view || dirty_count > max_dirty_ratio * tile_count)
+        {
+            target.tile_mask.clear();
+            target.ClearSurface(clear_color);
+            target.ClearDepth();
+            needs_draw.resize(instances.size());
+            
+            for (size_t i = 0; i < instances.size(); ++i)
+            {
+                needs_draw[i] = instances[i].model != nullptr;
+            }
+            
+            return tile_count;
+        }
+        
+        // clear tiles that are about to be drawn again, and find which instances touch any of them
+        for (int ty = 0; ty < target.GetTileRows(); ++ty)
+        {
+            for (int tx = 0; tx < tile_columns; ++tx)
+            {
+                if (mask[ty * tile_columns + tx] != 0)
+                { target.ClearTile(tx, ty, clear_color); }
+            }
+        }
+        
+        needs_draw.assign(instances.size(), 0);
+        
+        for (size_t i = 0; dirty_count > 0 && i < instances.size(); ++i)
+        {
+            for (int ty = tiles[i].y1; needs_draw[i] == 0 && ty <= tiles[i].y2; ++ty)
+            {
+                for (int tx = tiles[i].x1; tx <= tiles[i].x2; ++tx)
+                {
+                    if (mask[ty * tile_columns + tx] != 0)
+                    {
+                        needs_draw[i] = 1;
+                        break;
+                    }
+                }
+            }
+        }
+        
+        target.tile_mask = std::move(mask);
+        return dirty_count;
+    }
+    
+    // whether the instance at the given index of the current frame has to be drawn again
+    inline bool NeedsDraw(size_t i) const
+    {
+        return i < needs_draw.size() && needs_draw[i] != 0;
+    }
+    
+    // lets the whole target be drawn to again
+    inline void End(Target& target)
+    {
+        target.tile_mask.clear();
+    }
+    
+    // draws every instance that needs to be drawn again with the given renderer, reusing their triangles' setup from
+    // previous frames where possible (returns how many tiles were drawn)
+    inline size_t Draw(const Renderer3D& renderer, Target& target, const Camera3D& camera, const Screen& screen, const std::vector<Instance3D>& instances, const Color3D& clear_color)
+    {
+        auto dirty_count = Begin(target, camera, screen, instances, clear_color);
+        
+        for (size_t i = 0; i < instances.size(); ++i)
+        {
+            if (NeedsDraw(i))
+            { setup_cache.Blit3DModel(renderer, target, instances[i].state, camera, screen, *instances[i].model, instances[i].transform); }
+        }
+        
+        End(target);
+        return dirty_count;
+    }
+};
\ No newline at end of file
@@ -0,0 +1,672 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <new>
+
+#include <glm/glm.hpp>
+
+#include "color.hpp"
+#include "math.hpp"
+#include "palette.hpp"
+#include "simd.hpp"
+
+
+// the ways pixels can be laid out in an image
+enum class PixelFormat3D
+{
+    // 32 bits per pixel, packed as 0xAARRGGBB (the same as SDL_PIXELFORMAT_ARGB8888)
+    ARGB8888,
+    
+    // 16 bits per pixel, packed as 5 bits of red, 6 of green and 5 of blue (the same as SDL_PIXELFORMAT_RGB565)
+    RGB565,
+    
+    // 8 bits per pixel, each one an index into a Palette3D
+    Index8,
+    
+    // 4 bits per pixel, compressed in blocks of 4x4 pixels like BC1 (or DXT1) textures on GPUs
+    // (only meant for textures, since pixels can be read but not written one by one)
+    BC1,
+};
+
+
+// returns how many bytes a single pixel takes up in the given format
+inline constexpr int GetBytesPerPixel(PixelFormat3D format)
+{
+    switch (format)
+    {
+        case PixelFormat3D::RGB565:
+            return 2;
+        
+        case PixelFormat3D::Index8:
+            return 1;
+        
+        // block compressed pixels take up less than a byte each
+        case PixelFormat3D::BC1:
+            return 0;
+        
+        default:
+            return 4;
+    }
+}
+
+
+// returns the name a pixel format is saved as in text files
+inline const char* GetPixelFormatName(PixelFormat3D format)
+{
+    switch (format)
+    {
+        case PixelFormat3D::RGB565:
+            return "rgb565";
+        
+        case PixelFormat3D::Index8:
+            return "index8";
+        
+        case PixelFormat3D::BC1:
+            return "bc1";
+        
+        default:
+            return "argb8888";
+    }
+}
+
+
+// returns the pixel format with the given name (unknown names are ARGB8888)
+inline PixelFormat3D ParsePixelFormat(const std::string& name)
+{
+    if (name == "rgb565")
+    { return PixelFormat3D::RGB565; }
+    else if (name == "index8")
+    { return PixelFormat3D::Index8; }
+    else if (name == "bc1")
+    { return PixelFormat3D::BC1; }
+    else
+    { return PixelFormat3D::ARGB8888; }
+}
+
+
+// packs a color into a 32 bit ARGB8888 pixel
+inline constexpr Uint32 PackARGB8888(const Color3D& color)
+{
+    return ((Uint32)color.a << 24) | ((Uint32)color.r << 16) | ((Uint32)color.g << 8) | (Uint32)color.b;
+}
+
+
+// unpacks a 32 bit ARGB8888 pixel into a color
+inline constexpr Color3D UnpackARGB8888(Uint32 pixel)
+{
+    return Color3D{ (Uint8)(pixel >> 16), (Uint8)(pixel >> 8), (Uint8)pixel, (Uint8)(pixel >> 24) };
+}
+
+
+// packs a color into a 16 bit RGB565 pixel
+inline constexpr Uint16 PackRGB565(const Color3D& color)
+{
+    return (Uint16)(((color.r >> 3) << 11) | ((color.g >> 2) << 5) | (color.b >> 3));
+}
+
+
+// packs a color into a 16 bit RGB565 pixel, nudged by an ordered dither pattern at the given pixel so that smooth
+// gradients don't band
+// (each channel is scaled to its 565 levels, nudged up by anywhere from just over nothing to just under a whole level,
+// and truncated, so it rounds up exactly as often as it lies past the level below it and keeps its average brightness)
+inline Uint16 PackRGB565Dithered(const Color3D& color, int x, int y)
+{
+    auto nudge = (GetDitherThreshold(x, y) + 16) * 255;
+    auto r = (color.r * 31 * 32 + nudge) / (255 * 32);
+    auto g = (color.g * 63 * 32 + nudge) / (255 * 32);
+    auto b = (color.b * 31 * 32 + nudge) / (255 * 32);
+    
+    return (Uint16)((r << 11) | (g << 5) | b);
+}
+
+
+// unpacks a 16 bit RGB565 pixel into a color (the top bits of each channel are repeated so that white stays white)
+inline constexpr Color3D UnpackRGB565(Uint16 pixel)
+{
+    auto r = (pixel >> 11) & 0x1F;
+    auto g = (pixel >> 5) & 0x3F;
+    auto b = pixel & 0x1F;
+    
+    return Color3D{ (Uint8)((r << 3) | (r >> 2)), (Uint8)((g << 2) | (g >> 4)), (Uint8)((b << 3) | (b >> 2)), 255 };
+}
+
+
+// returns the 4 colors a BC1 block with the given endpoints can pick between for each of its pixels
+// (4 opaque colors along the line between the endpoints if the first one is greater, otherwise 3 and transparent black)
+inline std::array<Color3D, 4> GetBC1Colors(Uint16 endpoint0, Uint16 endpoint1)
+{
+    auto a = UnpackRGB565(endpoint0);
+    auto b = UnpackRGB565(endpoint1);
+    
+    auto mix = [&](int wa, int wb, int total)
+    {
+        return Color3D{
+            (Uint8)((a.r * wa + b.r * wb) / total),
+            (Uint8)((a.g * wa + b.g * wb) / total),
+            (Uint8)((a.b * wa + b.b * wb) / total),
+            255
+        };
+    };
+    
+    if (endpoint0 > endpoint1)
+    { return { a, b, mix(2, 1, 3), mix(1, 2, 3) }; }
+    else
+    { return { a, b, mix(1, 1, 2), Color3D{ 0, 0, 0, 0 } }; }
+}
+
+
+// decodes a single 8 byte BC1 block into its 16 pixels as ARGB8888, row by row
+// (blocks start with 2 RGB565 endpoints, followed by 2 bits per pixel choosing one of the colors they make)
+inline void DecodeBC1Block(const Uint8* block, Uint32* out_pixels)
+{
+    auto endpoint0 = (Uint16)(block[0] | (block[1] << 8));
+    auto endpoint1 = (Uint16)(block[2] | (block[3] << 8));
+    auto bits = (Uint32)block[4] | ((Uint32)block[5] << 8) | ((Uint32)block[6] << 16) | ((Uint32)block[7] << 24);
+    
+    auto colors = GetBC1Colors(endpoint0, endpoint1);
+    std::array<Uint32, 4> pixels{ PackARGB8888(colors[0]), PackARGB8888(colors[1]), PackARGB8888(colors[2]), PackARGB8888(colors[3]) };
+    
+    for (int i = 0; i < 16; ++i)
+    {
+        out_pixels[i] = pixels[(bits >> (i * 2)) & 3];
+    }
+}
+
+
+// BC1 blocks recently decoded by one thread, so that neighboring texel reads only decode each block once
+// (entries are looked up by the block's compressed bytes rather than its address, so they can never go stale, and start
+// out as the all zero block, which they correctly hold decoded)
+struct BC1BlockCache3D
+{
+    static constexpr size_t size = 128;
+    
+    std::array<Uint64, size> blocks{};
+    std::array<std::array<Uint32, 16>, size> pixels;
+    
+    inline BC1BlockCache3D()
+    {
+        for (auto& block: pixels)
+        {
+            block.fill(PackARGB8888(Color3D{ 0, 0, 0, 255 }));
+        }
+    }
+};
+
+
+// returns the calling thread's decoded BC1 block cache (every thread gets its own, so sampling never shares any memory)
+inline BC1BlockCache3D& GetBC1BlockCache()
+{
+    thread_local BC1BlockCache3D cache;
+    return cache;
+}
+
+
+// reads a single pixel of the given BC1 block as ARGB8888, decoding the block only if this thread hasn't recently
+inline Uint32 ReadBC1Pixel(const Uint8* block, int x, int y)
+{
+    Uint64 bytes;
+    std::memcpy(&bytes, block, sizeof(bytes));
+    
+    auto& cache = GetBC1BlockCache();
+    auto slot = (size_t)((bytes * 0x9E3779B97F4A7C15ull) >> 57);
+    
+    if (cache.blocks[slot] != bytes)
+    {
+        cache.blocks[slot] = bytes;
+        DecodeBC1Block(block, cache.pixels[slot].data());
+    }
+    
+    return cache.pixels[slot][y * 4 + x];
+}
+
+
+// a block of pixels in a single format, used both as a render target's color buffer and as a texture
+// (images either own an aligned buffer, which copies of them share, or wrap memory owned by someone else)
+struct Image3D
+{
+    // every row starts on a boundary of this many bytes, so that vector kernels never straddle cache lines needlessly
+    static constexpr size_t alignment = 64;
+    
+    PixelFormat3D format = PixelFormat3D::ARGB8888;
+    int width = 0;
+    int height = 0;
+    int pitch = 0;
+    Uint8* pixels = nullptr;
+    std::shared_ptr<Uint8> storage;
+    
+    // palette the pixels of Index8 images are indices into
+    const Palette3D* palette = nullptr;
+    
+    // constructs an empty image
+    inline Image3D() = default;
+    
+    // constructs an image that owns a buffer of the given size and format, cleared to zero
+    // (BC1 images store rows of 4x4 pixel blocks instead of rows of pixels, with the pitch being that of a row of blocks)
+    inline Image3D(int width, int height, PixelFormat3D format = PixelFormat3D::ARGB8888):
+        format(format),
+        width(width),
+        height(height)
+    {
+        auto compressed = format == PixelFormat3D::BC1;
+        auto row_bytes = compressed ? (width + 3) / 4 * 8 : width * ::GetBytesPerPixel(format);
+        auto rows = compressed ? (height + 3) / 4 : height;
+        
+        pitch = (int)((row_bytes + alignment - 1) / alignment * alignment);
+        
+        auto size = std::max<size_t>((size_t)pitch * rows, 1);
+        auto buffer = (Uint8*)::operator new(size, std::align_val_t(alignment));
+        std::memset(buffer, 0, size);
+        
+        storage = std::shared_ptr<Uint8>(buffer, [](Uint8* p) { ::operator delete(p, std::align_val_t(alignment)); });
+        pixels = buffer;
+    }
+    
+    // constructs an image that draws into memory owned by someone else (like a window surface), which must outlive it
+    inline static Image3D Wrap(void* pixels, int width, int height, int pitch, PixelFormat3D format)
+    {
+        Image3D image;
+        image.format = format;
+        image.width = width;
+        image.height = height;
+        image.pitch = pitch;
+        image.pixels = (Uint8*)pixels;
+        return image;
+    }
+    
+    // whether this image has no pixels at all
+    inline bool IsEmpty() const
+    {
+        return pixels == nullptr || width <= 0 || height <= 0;
+    }
+    
+    // returns how many bytes a single pixel of this image takes up
+    inline int GetBytesPerPixel() const
+    {
+        return ::GetBytesPerPixel(format);
+    }
+    
+    // returns a pointer to the first byte of the given row
+    inline Uint8* GetRow(int y) const
+    {
+        return pixels + y * pitch;
+    }
+    
+    // returns a pointer to the first pixel of the given row of a 32 bit image
+    inline Uint32* GetPixelRow(int y) const
+    {
+        return (Uint32*)GetRow(y);
+    }
+    
+    // converts a color into a pixel value in this image's format (Index8 images need a palette for this)
+    inline Uint32 Map(const Color3D& color) const
+    {
+        switch (format)
+        {
+            case PixelFormat3D::RGB565:
+                return PackRGB565(color);
+            
+            case PixelFormat3D::Index8:
+                return palette != nullptr ? palette->Match(color) : 0;
+            
+            // pixels of BC1 images are read as ARGB8888
+            default:
+                return PackARGB8888(color);
+        }
+    }
+    
+    // converts a pixel value in this image's format back into a color
+    inline Color3D Unmap(Uint32 pixel) const
+    {
+        switch (format)
+        {
+            case PixelFormat3D::RGB565:
+                return UnpackRGB565((Uint16)pixel);
+            
+            case PixelFormat3D::Index8:
+                return palette != nullptr ? palette->colors[pixel & 0xFF] : Color3D{ 0, 0, 0, 255 };
+            
+            default:
+                return UnpackARGB8888(pixel);
+        }
+    }
+    
+    // reads the raw value of a single pixel (the pixel must exist)
+    inline Uint32 ReadPixel(int x, int y) const
+    {
+        auto row = GetRow(y);
+        
+        switch (format)
+        {
+            case PixelFormat3D::RGB565:
+                return ((const Uint16*)row)[x];
+            
+            case PixelFormat3D::Index8:
+                return row[x];
+            
+            case PixelFormat3D::BC1:
+                return ReadBC1Pixel(pixels + (y >> 2) * pitch + (x >> 2) * 8, x & 3, y & 3);
+            
+            default:
+                return ((const Uint32*)row)[x];
+        }
+    }
+    
+    // writes the raw value of a single pixel (the pixel must exist, and BC1 images are left alone)
+    inline void WritePixel(int x, int y, Uint32 pixel)
+    {
+        auto row = GetRow(y);
+        
+        switch (format)
+        {
+            case PixelFormat3D::RGB565:
+                ((Uint16*)row)[x] = (Uint16)pixel;
+                break;
+            
+            case PixelFormat3D::Index8:
+                row[x] = (Uint8)pixel;
+                break;
+            
+            case PixelFormat3D::BC1:
+                break;
+            
+            default:
+                ((Uint32*)row)[x] = pixel;
+                break;
+        }
+    }
+    
+    // reads the color of a single pixel (the pixel must exist)
+    inline Color3D Read(int x, int y) const
+    {
+        return Unmap(ReadPixel(x, y));
+    }
+    
+    // fills a rectangle of pixels with a single raw value (the rectangle must lie within the image, and BC1 images are
+    // left alone)
+    inline void Fill(int x, int y, int w, int h, Uint32 pixel)
+    {
+        if (format == PixelFormat3D::BC1)
+        { return; }
+        
+        for (int yy = y; yy < y + h; ++yy)
+        {
+            auto row = GetRow(yy);
+            
+            switch (format)
+            {
+                case PixelFormat3D::RGB565:
+                    std::fill((Uint16*)row + x, (Uint16*)row + x + w, (Uint16)pixel);
+                    break;
+                
+                case PixelFormat3D::Index8:
+                    std::memset(row + x, (Uint8)pixel, w);
+                    break;
+                
+                default:
+                    GetSimdKernels().fill_pixels((Uint32*)row + x, w, pixel);
+                    break;
+            }
+        }
+    }
+    
+    // fills every pixel with a single raw value
+    inline void Fill(Uint32 pixel)
+    {
+        Fill(0, 0, width, height, pixel);
+    }
+};
+
+
+// samples a pixel in the given image using normalized coordinates (coordinates outside of it sample opaque black)
+inline Color3D Sample(const Image3D& image, float u, float v)
+{
+    auto x = (int)Lerp(0.0f, float(image.width), u);
+    auto y = (int)Lerp(float(image.height), 0.0f, v);
+    
+    if (x >= 0 && x <= image.width && y >= 0 && y <= image.height)
+    { return image.Read(std::min(x, image.width - 1), std::min(y, image.height - 1)); }
+    else
+    { return { 0, 0, 0, 255 }; }
+}
+
+
+// samples a palette index in the given Index8 image using normalized coordinates (like Sample, without converting it)
+inline Uint8 SampleIndex(const Image3D& image, float u, float v)
+{
+    auto x = (int)Lerp(0.0f, float(image.width), u);
+    auto y = (int)Lerp(float(image.height), 0.0f, v);
+    
+    if (x >= 0 && x <= image.width && y >= 0 && y <= image.height)
+    { return image.GetRow(std::min(y, image.height - 1))[std::min(x, image.width - 1)]; }
+    else
+    { return 0; }
+}
+
+
+// creates an Index8 image that stores indices into the given palette
+inline Image3D CreateIndexedImage(int width, int height, const Palette3D& palette)
+{
+    Image3D image(width, height, PixelFormat3D::Index8);
+    image.palette = &palette;
+    return image;
+}
+
+
+// encodes 16 pixels, row by row, into a single 8 byte BC1 block
+// (endpoints are picked at the extremes of the pixels' colors along the direction they vary the most in, and pixels with
+// less than half alpha make the block use transparent black)
+inline void EncodeBC1Block(const Color3D* pixels, Uint8* out_block)
+{
+    auto transparent = false;
+    auto mean = glm::vec3(0.0f);
+    int opaque_count = 0;
+    
+    for (int i = 0; i < 16; ++i)
+    {
+        if (pixels[i].a < 128)
+        {
+            transparent = true;
+            continue;
+        }
+        
+        mean += glm::vec3(pixels[i].r, pixels[i].g, pixels[i].b);
+        opaque_count += 1;
+    }
+    
+    mean /= std::max(opaque_count, 1);
+    
+    // find the direction colors vary the most in, by running a few steps of power iteration on their covariance
+    auto covariance = glm::mat3(0.0f);
+    
+    for (int i = 0; i < 16; ++i)
+    {
+        if (pixels[i].a < 128)
+        { continue; }
+        
+        auto offset = glm::vec3(pixels[i].r, pixels[i].g, pixels[i].b) - mean;
+        covariance += glm::outerProduct(offset, offset);
+    }
+    
+    auto axis = glm::vec3(0.299f, 0.587f, 0.114f);
+    
+    for (int step = 0; step < 8; ++step)
+    {
+        auto next = covariance * axis;
+        auto length = glm::length(next);
+        
+        if (length < 1e-6f)
+        { break; }
+        
+        axis = next / length;
+    }
+    
+    // the colors furthest apart along that direction become the endpoints
+    auto min_t = std::numeric_limits<float>::max();
+    auto max_t = std::numeric_limits<float>::lowest();
+    
+    for (int i = 0; i < 16; ++i)
+    {
+        if (pixels[i].a < 128)
+        { continue; }
+        
+        auto t = glm::dot(glm::vec3(pixels[i].r, pixels[i].g, pixels[i].b) - mean, axis);
+        min_t = std::min(min_t, t);
+        max_t = std::max(max_t, t);
+    }
+    
+    if (opaque_count == 0)
+    { min_t = max_t = 0.0f; }
+    
+    auto to_color = [](const glm::vec3& color)
+    {
+        auto clamped = glm::clamp(glm::round(color), 0.0f, 255.0f);
+        return Color3D{ (Uint8)clamped.x, (Uint8)clamped.y, (Uint8)clamped.z, 255 };
+    };
+    
+    auto endpoint0 = PackRGB565(to_color(mean + axis * max_t));
+    auto endpoint1 = PackRGB565(to_color(mean + axis * min_t));
+    
+    // the order of the endpoints picks between 4 opaque colors, or 3 and transparent black
+    if (transparent ? endpoint0 > endpoint1 : endpoint0 < endpoint1)
+    { std::swap(endpoint0, endpoint1); }
+    
+    auto colors = GetBC1Colors(endpoint0, endpoint1);
+    Uint32 bits = 0;
+    
+    for (int i = 0; i < 16; ++i)
+    {
+        auto best = 3;
+        
+        if (pixels[i].a >= 128)
+        {
+            auto best_error = std::numeric_limits<int>::max();
+            auto choices = endpoint0 > endpoint1 ? 4 : 3;
+            
+            for (int c = 0; c < choices; ++c)
+            {
+                auto dr = (int)pixels[i].r - colors[c].r;
+                auto dg = (int)pixels[i].g - colors[c].g;
+                auto db = (int)pixels[i].b - colors[c].b;
+                auto error = dr * dr + dg * dg + db * db;
+                
+                if (error < best_error)
+                {
+                    best = c;
+                    best_error = error;
+                }
+            }
+        }
+        
+        bits |= (Uint32)best << (i * 2);
+    }
+    
+    out_block[0] = (Uint8)endpoint0;
+    out_block[1] = (Uint8)(endpoint0 >> 8);
+    out_block[2] = (Uint8)endpoint1;
+    out_block[3] = (Uint8)(endpoint1 >> 8);
+    out_block[4] = (Uint8)bits;
+    out_block[5] = (Uint8)(bits >> 8);
+    out_block[6] = (Uint8)(bits >> 16);
+    out_block[7] = (Uint8)(bits >> 24);
+}
+
+
+// compresses an image into a BC1 image, 4x4 pixels at a time (edge pixels are repeated to fill partial blocks)
+inline Image3D CompressImage(const Image3D& image)
+{
+    Image3D result(image.width, image.height, PixelFormat3D::BC1);
+    std::array<Color3D, 16> pixels;
+    
+    for (int by = 0; by < (image.height + 3) / 4; ++by)
+    {
+        auto row = result.GetRow(by);
+        
+        for (int bx = 0; bx < (image.width + 3) / 4; ++bx)
+        {
+            for (int i = 0; i < 16; ++i)
+            {
+                auto x = std::min(bx * 4 + (i & 3), image.width - 1);
+                auto y = std::min(by * 4 + (i >> 2), image.height - 1);
+                pixels[i] = image.Read(x, y);
+            }
+            
+            EncodeBC1Block(pixels.data(), row + bx * 8);
+        }
+    }
+    
+    return result;
+}
+
+
+// converts an image into another format (meant to be done once when loading textures, since compressing them is slow)
+inline Image3D ConvertImage(const Image3D& image, PixelFormat3D format)
+{
+    if (format == PixelFormat3D::BC1)
+    { return CompressImage(image); }
+    
+    Image3D result(image.width, image.height, format);
+    
+    for (int y = 0; y < image.height; ++y)
+    {
+        for (int x = 0; x < image.width; ++x)
+        {
+            result.WritePixel(x, y, result.Map(image.Read(x, y)));
+        }
+    }
+    
+    return result;
+}
+
+
+// converts an image into an Index8 image using the given palette
+// (meant to be done once when loading textures, so that rendering only ever reads palette indices, and not dithered
+// since magnified textures would blow the dither pattern up along with them)
+inline Image3D QuantizeImage(const Image3D& image, const Palette3D& palette)
+{
+    auto indexed = CreateIndexedImage(image.width, image.height, palette);
+    
+    for (int y = 0; y < image.height; ++y)
+    {
+        auto row = indexed.GetRow(y);
+        
+        for (int x = 0; x < image.width; ++x)
+        {
+            row[x] = palette.Match(image.Read(x, y));
+        }
+    }
+    
+    return indexed;
+}
+
+
+// expands an Index8 image into a 32 bit image of the same size using its palette, which only has to happen once per
+// frame right before presenting it
+inline void ExpandImage(const Image3D& indexed, Image3D& out)
+{
+    if (indexed.palette == nullptr)
+    { return; }
+    
+    std::array<Uint32, 256> pixels;
+    
+    for (size_t i = 0; i < pixels.size(); ++i)
+    {
+        pixels[i] = PackARGB8888(indexed.palette->colors[i]);
+    }
+    
+    auto width = std::min(indexed.width, out.width);
+    auto height = std::min(indexed.height, out.height);
+    
+    for (int y = 0; y < height; ++y)
+    {
+        auto in_row = indexed.GetRow(y);
+        auto out_row = out.GetPixelRow(y);
+        
+        for (int x = 0; x < width; ++x)
+        {
+            out_row[x] = pixels[in_row[x]];
+        }
+    }
+}
\ No newline at end of file
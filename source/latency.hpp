@@ -0,0 +1,94 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <optional>
+#include <vector>
+
+
+// a summary of input to present latencies, in milliseconds
+struct LatencyStats3D
+{
+    size_t count = 0;
+    double mean = 0.0;
+    double median = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+};
+
+
+// measures how long it takes input to show up on screen, from when the input happened until the frame it was applied
+// to got presented
+// (every frame reports its inputs with AddInput, Latch once they've been applied to what's about to be drawn, and
+// Present once that got presented; only the oldest input of each frame counts, since that's the one waiting longest)
+struct LatencyTracker3D
+{
+    using Clock = std::chrono::steady_clock;
+    
+    // how many of the latest latencies are kept
+    size_t max_samples = 4096;
+    
+    // the oldest input not applied to a frame yet, and the oldest one applied to the frame being drawn
+    std::optional<Clock::time_point> pending_input;
+    std::optional<Clock::time_point> latched_input;
+    
+    // the latest latencies in milliseconds, with the oldest one replaced once there are max_samples of them
+    std::vector<double> samples;
+    size_t next_sample = 0;
+    
+    // notes that input happened at the given time
+    inline void AddInput(Clock::time_point time)
+    {
+        if (!pending_input || time < *pending_input)
+        { pending_input = time; }
+    }
+    
+    // notes that every input so far has been applied to the frame about to be drawn
+    inline void Latch()
+    {
+        if (pending_input && (!latched_input || *pending_input < *latched_input))
+        { latched_input = pending_input; }
+        
+        pending_input.reset();
+    }
+    
+    // notes that the frame inputs were latched into got presented at the given time
+    inline void Present(Clock::time_point time = Clock::now())
+    {
+        if (!latched_input)
+        { return; }
+        
+        auto latency = std::chrono::duration<double, std::milli>(time - *latched_input).count();
+        latched_input.reset();
+        
+        if (samples.size() < max_samples)
+        { samples.push_back(latency); }
+        else
+        { samples[next_sample] = latency; }
+        
+        next_sample = (next_sample + 1) % max_samples;
+    }
+    
+    // summarizes the latest latencies
+    inline LatencyStats3D GetStats() const
+    {
+        LatencyStats3D stats;
+        stats.count = samples.size();
+        
+        if (samples.empty())
+        { return stats; }
+        
+        auto sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        
+        for (auto sample: sorted)
+        {
+            stats.mean += sample / sorted.size();
+        }
+        
+        stats.median = sorted[sorted.size() / 2];
+        stats.p99 = sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)];
+        stats.max = sorted.back();
+        
+        return stats;
+    }
+};
\ No newline at end of file
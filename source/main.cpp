@@ -6,6 +6,8 @@
 #include <vector>
 #include <filesystem>
 #include <fstream>
+#include <iostream>
+#include <cstdlib>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
@@ -15,6 +17,16 @@
 #include "sdl_extra.hpp"
 #include "math.hpp"
 #include "renderer.hpp"
+#include "image.hpp"
+#include "palette.hpp"
+#include "collision.hpp"
+#include "temporal.hpp"
+#include "checkerboard.hpp"
+#include "commands.hpp"
+#include "dirty.hpp"
+#include "setup.hpp"
+#include "latency.hpp"
+#include "pacing.hpp"
 
 
 int main(int, char**)
@@ -26,23 +38,57 @@ int main(int, char**)
     // create window and renderer
     int window_scale = 3;
     SDL_Window* window = SDL_CreateWindow("SmolSoft3D", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, window_scale * 400, window_scale * 240, SDL_WINDOW_HIDDEN);
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC);
+    
+    // SMOLSOFT3D_FPS turns vsync off and paces frames to that many per second instead, so that frame times show what
+    // frames really cost rather than how long vsync waited
+    FramePacer3D pacer;
+    
+    if (auto fps = std::getenv("SMOLSOFT3D_FPS"))
+    { pacer.SetTargetRate(std::atof(fps)); }
+    
+    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, pacer.interval > FramePacer3D::Clock::duration::zero() ? 0 : SDL_RENDERER_PRESENTVSYNC);
     
     // prevent window from appearing white for a split second at startup
     SDL_RenderClear(renderer);
     SDL_ShowWindow(window);
     
-    // create surface and its texture
-    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, 400, 240, 32, SDL_PIXELFORMAT_BGRA32);
+    // create surface and its texture (the renderer draws straight into the surface's pixels)
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, 400, 240, 32, SDL_PIXELFORMAT_ARGB8888);
     SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
     
-    // load images to sample
-    SDL_Surface* goober = IMG_Load("./assets/goober.png");
-    SDL_Surface* crate = IMG_Load("./assets/crate.png");
+    // create a 16 bit surface and texture too, which take half the memory and can be presented without converting them
+    SDL_Surface* surface_565 = SDL_CreateRGBSurfaceWithFormat(0, 400, 240, 16, SDL_PIXELFORMAT_RGB565);
+    SDL_Texture* texture_565 = SDL_CreateTextureFromSurface(renderer, surface_565);
+    
+    // load images to sample, and copy them into images the renderer can read
+    SDL_Surface* goober_surface = IMG_Load("./assets/goober.png");
+    SDL_Surface* crate_surface = IMG_Load("./assets/crate.png");
+    
+    Image3D goober = SDL_CopySurface(goober_surface);
+    Image3D crate = SDL_CopySurface(crate_surface);
+    
+    SDL_FreeSurface(goober_surface);
+    SDL_FreeSurface(crate_surface);
+    
+    // 16 bit copies of the images, for drawing to the 16 bit surface
+    Image3D goober_565 = ConvertImage(goober, PixelFormat3D::RGB565);
+    Image3D crate_565 = ConvertImage(crate, PixelFormat3D::RGB565);
+    
+    // block compressed copies of the images, which take an eighth of the memory to sample from
+    Image3D goober_bc1 = ConvertImage(goober, PixelFormat3D::BC1);
+    Image3D crate_bc1 = ConvertImage(crate, PixelFormat3D::BC1);
     
     // rendering structs
     Renderer3D renderer3d;
-    Target target = surface;
+    Target target = SDL_WrapSurface(surface);
+    Target target_565 = SDL_WrapSurface(surface_565);
+    
+    // 8 bit target and textures sharing a single palette, which get expanded to the 32 bit surface when presenting
+    Palette3D palette;
+    Target indexed_target = CreateIndexedImage(surface->w, surface->h, palette);
+    Image3D goober_indexed = QuantizeImage(goober, palette);
+    Image3D crate_indexed = QuantizeImage(crate, palette);
+    
     Camera3D camera{ glm::vec3(3.5f, 1.5f, -2.0f), 45.0f, -20.0f };
     Screen screen{ (float)surface->w, (float)surface->h, 60.0f };
     
@@ -52,6 +98,28 @@ int main(int, char**)
     
     // global variables
     float sensitivity = 0.2f;
+    bool use_reprojection = false;
+    bool use_dirty_tiles = false;
+    bool use_compressed = false;
+    int bit_depth = 32;
+    
+    // reuses the previous frame's pixels when reprojection is toggled on
+    TemporalReprojector3D reprojector;
+    
+    // fills in the pixels skipped when only drawing half of them
+    RenderPattern render_pattern = RenderPattern::Full;
+    CheckerboardResolver3D resolver;
+    
+    // only redraws tiles that something moved in or out of when dirty tiles are toggled on
+    DirtyTileTracker3D dirty_tiles;
+    
+    // measures how long mouse motion takes to show up on screen
+    LatencyTracker3D latency;
+    
+    // SIGUSR1 dumps frame time histograms while running (they're also dumped on exit if frames are paced, or if any
+    // were dumped while running)
+    InstallDumpSignal();
+    bool histograms_requested = false;
     
     // game state
     float spike_x = 0.0f;
@@ -69,9 +137,52 @@ int main(int, char**)
     Model3D crate_model;
     TryLoadModel("./assets/crate.txt", crate_model);
     
+    // where the spike is placed in the level
+    auto spike_transform = glm::translate(glm::mat4(1.0f), glm::vec3(-2.0f, 0.0f, 2.0f));
+    
+    // gather level geometry the camera can collide with
+    float camera_radius = 0.3f;
+    CollisionGrid3D level_grid;
+    level_grid.AddModel(floor_model);
+    level_grid.AddModel(crate_model);
+    level_grid.AddModel(triangle_model);
+    level_grid.AddModel(spike_model, spike_transform);
+    
+    // resources that recorded draws refer to by id, named after where they came from so saved frames can be replayed
+    CommandResources3D resources;
+    auto floor_id = resources.AddModel(floor_model, "./assets/floor.txt");
+    auto triangle_id = resources.AddModel(triangle_model, "./assets/triangle.txt");
+    auto spike_id = resources.AddModel(spike_model, "./assets/spike.txt");
+    auto crate_id = resources.AddModel(crate_model, "./assets/crate.txt");
+    
+    auto goober_id = resources.AddImage(goober, "./assets/goober.png");
+    auto crate_image_id = resources.AddImage(crate, "./assets/crate.png");
+    auto goober_565_id = resources.AddImage(goober_565, "./assets/goober.png");
+    auto crate_565_id = resources.AddImage(crate_565, "./assets/crate.png");
+    auto goober_indexed_id = resources.AddImage(goober_indexed, "./assets/goober.png");
+    auto crate_indexed_id = resources.AddImage(crate_indexed, "./assets/crate.png");
+    auto goober_bc1_id = resources.AddImage(goober_bc1, "./assets/goober.png");
+    auto crate_bc1_id = resources.AddImage(crate_bc1, "./assets/crate.png");
+    
+    // triangles set up by previous frames, reused for as long as the camera stays still
+    TriangleSetupCache3D setup_cache;
+    
+    // each frame's draws get recorded here, then submitted all at once (and saved to a file when F12 is pressed)
+    CommandBuffer3D frame_commands;
+    bool save_frame = false;
+    
     // main loop
     for (bool running = true; running;)
     {
+        // paced frames sleep here, before reading any input, so that the input is as fresh as possible once presented
+        pacer.BeginFrame();
+        
+        if (pacer.TakeDumpRequest())
+        {
+            pacer.WriteHistograms(std::cout);
+            histograms_requested = true;
+        }
+        
         // process events
         for (SDL_Event event{}; running && SDL_PollEvent(&event);)
         {
@@ -82,13 +193,9 @@ int main(int, char**)
                     break;
                 
                 case SDL_MOUSEMOTION:
+                    // the camera only turns once input gets latched right before drawing, this just notes when it happened
                     if (SDL_GetRelativeMouseMode())
-                    {
-                        camera.Turn(
-                            -sensitivity * (float)event.motion.xrel,
-                            -sensitivity * (float)event.motion.yrel
-                        );
-                    }
+                    { latency.AddInput(SDL_GetEventTime(event.motion.timestamp)); }
                     break;
                 
                 case SDL_MOUSEBUTTONDOWN:
@@ -105,6 +212,51 @@ int main(int, char**)
                         SDL_SetRelativeMouseMode(SDL_FALSE);
                         SDL_ShowCursor(SDL_TRUE);
                     }
+                    else if (event.key.keysym.sym == SDLK_r)
+                    {
+                        use_reprojection = !use_reprojection;
+                        use_dirty_tiles = false;
+                        reprojector.Reset();
+                    }
+                    else if (event.key.keysym.sym == SDLK_t)
+                    {
+                        // reprojection and dirty tiles both keep the previous frame around, so only one can be on
+                        use_dirty_tiles = !use_dirty_tiles;
+                        use_reprojection = false;
+                        dirty_tiles.Reset();
+                    }
+                    else if (event.key.keysym.sym == SDLK_v)
+                    {
+                        // toggle between full rate and automatic variable rate shading
+                        auto rate = renderer3d.state.shading_rate == ShadingRate::Full ? ShadingRate::Auto : ShadingRate::Full;
+                        renderer3d.SetShadingRate(rate);
+                    }
+                    else if (event.key.keysym.sym == SDLK_p)
+                    {
+                        // cycle between 32 bit, 16 bit, and 8 bit palettized rendering
+                        bit_depth = bit_depth == 32 ? 16 : (bit_depth == 16 ? 8 : 32);
+                        reprojector.Reset();
+                    }
+                    else if (event.key.keysym.sym == SDLK_b)
+                    {
+                        // toggle between uncompressed and block compressed textures
+                        use_compressed = !use_compressed;
+                    }
+                    else if (event.key.keysym.sym == SDLK_l)
+                    {
+                        // toggle between multiplying colors in sRGB and in linear light
+                        renderer3d.SetLinearLight(!renderer3d.state.linear_light);
+                    }
+                    else if (event.key.keysym.sym == SDLK_c)
+                    {
+                        // cycle between drawing every pixel, a checkerboard, and every other line
+                        render_pattern = RenderPattern(((int)render_pattern + 1) % 3);
+                    }
+                    else if (event.key.keysym.sym == SDLK_F12)
+                    {
+                        // save the next frame's commands so the benchmark can replay them
+                        save_frame = true;
+                    }
                     break;
             }
         }
@@ -114,6 +266,37 @@ int main(int, char**)
         time_now = SDL_GetPerformanceCounter();
         float time_delta = float((time_now - time_prev) / double(SDL_GetPerformanceFrequency()));
         
+        // draw to the target and with the textures matching the current bit depth
+        auto& frame_target = bit_depth == 8 ? indexed_target : (bit_depth == 16 ? target_565 : target);
+        auto frame_goober = bit_depth == 8 ? goober_indexed_id : (bit_depth == 16 ? goober_565_id : goober_id);
+        auto frame_crate = bit_depth == 8 ? crate_indexed_id : (bit_depth == 16 ? crate_565_id : crate_image_id);
+        
+        if (use_compressed)
+        {
+            frame_goober = goober_bc1_id;
+            frame_crate = crate_bc1_id;
+        }
+        
+        // latch input into the camera as late as possible, right before anything gets drawn with it, rather than when
+        // events were processed
+        SDL_PumpEvents();
+        
+        // mouse motion that arrived since then gets applied to this frame too, so it shouldn't be seen again next frame
+        SDL_Event motion;
+        
+        if (SDL_PeepEvents(&motion, 1, SDL_PEEKEVENT, SDL_MOUSEMOTION, SDL_MOUSEMOTION) > 0 && SDL_GetRelativeMouseMode())
+        { latency.AddInput(SDL_GetEventTime(motion.motion.timestamp)); }
+        
+        SDL_FlushEvent(SDL_MOUSEMOTION);
+        
+        // turn camera by however far the mouse moved since the last frame was latched
+        int mouse_x = 0;
+        int mouse_y = 0;
+        SDL_GetRelativeMouseState(&mouse_x, &mouse_y);
+        
+        if (SDL_GetRelativeMouseMode())
+        { camera.Turn(-sensitivity * (float)mouse_x, -sensitivity * (float)mouse_y); }
+        
         // get key states
         auto keys = SDL_GetKeyboardState(nullptr);
         bool up     = keys[SDL_GetScancodeFromKey(SDLK_w)];
@@ -128,36 +311,118 @@ int main(int, char**)
         float move_speed = 2.2f;
         float move_factor = time_delta * move_speed;
         
-        camera.Move(move_factor * advance, move_factor * strafe, 0.0f);
+        MoveCamera(camera, level_grid, camera_radius, move_factor * advance, move_factor * strafe, 0.0f);
         
-        // clear target
-        target.ClearSurface({ 0, 0, 0, 255 });
-        target.ClearDepth();
+        latency.Latch();
         
-        // draw floor with a texture
-        renderer3d.SetSampler(goober);
-        renderer3d.Blit3DModel(target, camera, screen, floor_model);
+        // pick which pixels get drawn this frame (skipped pixels can only be filled in on 32 bit targets, and dirty tiles
+        // need every pixel of the previous frame)
+        auto frame_pattern = bit_depth == 32 && !use_dirty_tiles ? render_pattern : RenderPattern::Full;
+        resolver.Begin(frame_target, frame_pattern);
         
-        // draw crate
-        renderer3d.SetSampler(crate);
-        renderer3d.Blit3DModel(target, camera, screen, crate_model);
+        if (use_dirty_tiles)
+        {
+            // the same scene as below, as instances that can be compared with the previous frame's
+            auto rate = renderer3d.state.shading_rate;
+            auto linear = renderer3d.state.linear_light;
+            
+            std::vector<Instance3D> instances{
+                { &floor_model, PipelineState3D(resources.images[frame_goober], rate, linear) },
+                { &crate_model, PipelineState3D(resources.images[frame_crate], rate, linear) },
+                { &triangle_model, PipelineState3D(nullptr, rate, linear) },
+                { &spike_model, PipelineState3D(nullptr, rate, linear), spike_transform },
+            };
+            
+            dirty_tiles.Draw(renderer3d, frame_target, camera, screen, instances, { 0, 0, 0, 255 });
+        }
+        else
+        {
+            frame_commands.Clear();
+            
+            // clear target (or fill it with the previous frame and only redraw what's missing)
+            if (use_reprojection)
+            {
+                reprojector.Begin(frame_target, camera, screen, { 0, 0, 0, 255 });
+            }
+            else
+            {
+                frame_commands.ClearSurface({ 0, 0, 0, 255 });
+                frame_commands.ClearDepth();
+            }
+            
+            frame_commands.SetCamera(camera);
+            
+            // draw floor with a texture
+            frame_commands.SetSampler(frame_goober);
+            frame_commands.DrawModel(floor_id);
+            
+            // draw crate
+            frame_commands.SetSampler(frame_crate);
+            frame_commands.DrawModel(crate_id);
+            
+            // draw spike and colored triangle
+            frame_commands.SetSampler(CommandBuffer3D::none);
+            frame_commands.DrawModel(triangle_id);
+            
+            frame_commands.DrawModel(spike_id, spike_transform);
+            
+            SubmitCommands(renderer3d, frame_target, screen, resources, frame_commands, &setup_cache);
+            
+            if (save_frame)
+            {
+                SaveCommands("./frame.txt", frame_commands, resources, frame_target.image, screen);
+                save_frame = false;
+            }
+        }
+        
+        // fill in any pixels that were skipped
+        resolver.Resolve(frame_target);
         
-        // draw spike and colored triangle
-        renderer3d.SetSampler(nullptr);
-        renderer3d.Blit3DModel(target, camera, screen, triangle_model);
+        // remember this frame for the next one to reuse
+        if (use_reprojection)
+        {
+            reprojector.End(frame_target, camera);
+        }
+        
+        // palettized frames only become 32 bit colors here, right before presenting them
+        if (bit_depth == 8)
+        {
+            ExpandImage(indexed_target.image, target.image);
+        }
         
-        auto transform = glm::translate(glm::mat4(1.0f), glm::vec3(-2.0f, 0.0f, 2.0f));
-        renderer3d.Blit3DModel(target, camera, screen, spike_model, transform);
+        pacer.EndRender();
         
         // present our finished drawing to the window
-        SDL_UpdateTexture(texture, nullptr, surface->pixels, surface->pitch);
-        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+        if (bit_depth == 16)
+        {
+            SDL_UpdateTexture(texture_565, nullptr, surface_565->pixels, surface_565->pitch);
+            SDL_RenderCopy(renderer, texture_565, nullptr, nullptr);
+        }
+        else
+        {
+            SDL_UpdateTexture(texture, nullptr, surface->pixels, surface->pitch);
+            SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+        }
+        
+        pacer.WaitToPresent();
         SDL_RenderPresent(renderer);
+        latency.Present();
     }
     
     // quickly hide window to be more responsive
     SDL_HideWindow(window);
     
+    // report how long mouse motion took to show up on screen
+    if (auto stats = latency.GetStats(); stats.count > 0)
+    {
+        std::cout << "input to present latency over " << stats.count << " frames: " << stats.mean << "ms mean, ";
+        std::cout << stats.median << "ms median, " << stats.p99 << "ms 99th percentile, " << stats.max << "ms max\n";
+    }
+    
+    // report how long frames took, and how that split between rendering and waiting, if anyone was measuring
+    if (pacer.interval > FramePacer3D::Clock::duration::zero() || histograms_requested)
+    { pacer.WriteHistograms(std::cout); }
+    
     // quit sdl
     IMG_Quit();
     SDL_Quit();
@@ -2,9 +2,10 @@
 #include <cmath>
 #include <algorithm>
 
-#include <SDL2/SDL.h>
 #include <glm/glm.hpp>
 
+#include "color.hpp"
+
 
 // linearly interpolates between value a and b over the progress p
 inline constexpr float Lerp(float a, float b, float p)
@@ -27,10 +28,10 @@ inline constexpr float Remap(float x, float a, float b, float c, float d)
 }
 
 
-// linearly interpolates two SDL_Color values
-inline constexpr SDL_Color Lerp(const SDL_Color& a, const SDL_Color& b, float p)
+// linearly interpolates two Color3D values
+inline constexpr Color3D Lerp(const Color3D& a, const Color3D& b, float p)
 {
-    return SDL_Color
+    return Color3D
     {
         (Uint8)Lerp((float)a.r, (float)b.r, p),
         (Uint8)Lerp((float)a.g, (float)b.g, p),
@@ -68,8 +69,8 @@ inline constexpr float Clamp(float x, float a, float b)
 }
 
 
-// converts an SDL_Color to a glm::vec4
-inline constexpr glm::vec4 ToVec4(const SDL_Color& color)
+// converts a Color3D to a glm::vec4
+inline constexpr glm::vec4 ToVec4(const Color3D& color)
 {
     return glm::vec4
     {
@@ -81,10 +82,10 @@ inline constexpr glm::vec4 ToVec4(const SDL_Color& color)
 }
 
 
-// converts a glm::vec4 to an SDL_Color
-inline constexpr SDL_Color ToColor(const glm::vec4& color)
+// converts a glm::vec4 to a Color3D
+inline constexpr Color3D ToColor(const glm::vec4& color)
 {
-    return SDL_Color
+    return Color3D
     {
         Uint8(Clamp(color.x, 0.0f, 255.0f)),
         Uint8(Clamp(color.y, 0.0f, 255.0f)),
@@ -94,8 +95,34 @@ inline constexpr SDL_Color ToColor(const glm::vec4& color)
 }
 
 
-// blends two SDL_Color values together
-inline constexpr SDL_Color Blend(const SDL_Color& a, const SDL_Color& b)
+// returns the threshold of a 4x4 ordered dither pattern at the given pixel, in the range [-15, 15] (odd numbers only)
+// (adding it times a color's quantization step over 32 spreads the error of quantizing it evenly across neighbors)
+inline constexpr int GetDitherThreshold(int x, int y)
+{
+    constexpr int bayer[16]{ 0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5 };
+    return bayer[(y & 3) * 4 + (x & 3)] * 2 - 15;
+}
+
+
+// blends two Color3D values together
+inline constexpr Color3D Blend(const Color3D& a, const Color3D& b)
 {
     return ToColor(((ToVec4(a) / 255.0f) * (ToVec4(b) / 255.0f)) * 255.0f);
+}
+
+
+// blends two Color3D values together in linear light rather than sRGB, which keeps dark textures from getting muddy
+// (alpha isn't a color, so it's blended the same way Blend does, but rounded)
+inline Color3D BlendLinear(const Color3D& a, const Color3D& b)
+{
+    auto& tables = GetSrgbTables();
+    Uint32 alpha = a.a * b.a + 128;
+    
+    return Color3D
+    {
+        tables.Modulate(a.r, b.r),
+        tables.Modulate(a.g, b.g),
+        tables.Modulate(a.b, b.b),
+        Uint8((alpha + (alpha >> 8)) >> 8),
+    };
 }
\ No newline at end of file
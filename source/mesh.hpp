@@ -0,0 +1,285 @@
+#pragma once
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <vector>
+namespace fs = std::filesystem;
+
+#include <glm/glm.hpp>
+
+#include "color.hpp"
+#include "renderer.hpp"
+
+
+// how vertex positions are stored in a binary mesh file
+enum class MeshPositions3D: Uint8
+{
+    // 3 floats per position
+    Float,
+    
+    // 3 unsigned 16 bit integers per position, spread evenly across the model's bounding box (half the size of floats,
+    // on disk and also in memory for models loaded with LoadQuantizedMesh)
+    Quantized16,
+};
+
+
+// identifies binary mesh files, and which version of the format they were written with
+constexpr char mesh_magic[4] = { 'S', 'M', '3', 'D' };
+constexpr Uint32 mesh_version = 1;
+
+
+// writes a single value to a binary mesh file, in the byte order of the machine saving it
+template<typename T>
+inline void WriteMeshValue(std::ofstream& file, const T& value)
+{
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    file.write(bytes, sizeof(T));
+}
+
+
+// reads a single value from a binary mesh file (returns false if the file ended early)
+template<typename T>
+inline bool ReadMeshValue(std::ifstream& file, T& out_value)
+{
+    char bytes[sizeof(T)];
+    
+    if (!file.read(bytes, sizeof(T)))
+    { return false; }
+    
+    std::memcpy(&out_value, bytes, sizeof(T));
+    return true;
+}
+
+
+// builds the matrix that turns 16 bit positions quantized within the given bounds back into model space
+// (flat axes keep a scale of 1, since every position on them is quantized to 0 anyway)
+inline glm::mat4 GetDequantizeTransform(const AABB3D& bounds)
+{
+    auto size = bounds.max - bounds.min;
+    auto scale = glm::vec3(
+        size.x > 0.0f ? size.x / 65535.0f : 1.0f,
+        size.y > 0.0f ? size.y / 65535.0f : 1.0f,
+        size.z > 0.0f ? size.z / 65535.0f : 1.0f
+    );
+    
+    auto transform = glm::mat4(1.0f);
+    transform[0][0] = scale.x;
+    transform[1][1] = scale.y;
+    transform[2][2] = scale.z;
+    transform[3] = glm::vec4(bounds.min, 1.0f);
+    
+    return transform;
+}
+
+
+// quantizes a position to 16 bit integers spread evenly across the given bounds
+inline std::array<Uint16, 3> QuantizePosition(const glm::vec3& pos, const AABB3D& bounds)
+{
+    auto normalized = glm::clamp((pos - bounds.min) / glm::max(bounds.max - bounds.min, glm::vec3(1e-30f)), 0.0f, 1.0f);
+    
+    return {
+        (Uint16)std::lround(normalized.x * 65535.0f),
+        (Uint16)std::lround(normalized.y * 65535.0f),
+        (Uint16)std::lround(normalized.z * 65535.0f),
+    };
+}
+
+
+// saves a 3D model to a binary file, which loads much faster than a text one and can store positions quantized
+// (quantized positions are off by up to 1/131070th of the model's size along each axis)
+inline bool SaveMesh(const fs::path& filepath, const Model3D& model, MeshPositions3D positions = MeshPositions3D::Float)
+{
+    if (std::ofstream file(filepath, std::ios::binary); file)
+    {
+        AABB3D bounds;
+        
+        for (auto& triangle: model.triangles)
+        {
+            for (auto& vertex: triangle.vertices)
+            {
+                bounds.Grow(glm::vec3(vertex.pos));
+            }
+        }
+        
+        if (bounds.IsEmpty())
+        { bounds = AABB3D{ glm::vec3(0.0f), glm::vec3(0.0f) }; }
+        
+        // write metadata, including the bounds quantized positions are relative to
+        file.write(mesh_magic, sizeof(mesh_magic));
+        WriteMeshValue(file, mesh_version);
+        WriteMeshValue(file, (Uint32)model.triangles.size());
+        WriteMeshValue(file, (Uint8)positions);
+        WriteMeshValue(file, bounds.min);
+        WriteMeshValue(file, bounds.max);
+        
+        // write each vertex's data
+        for (auto& triangle: model.triangles)
+        {
+            for (auto& vertex: triangle.vertices)
+            {
+                if (positions == MeshPositions3D::Quantized16)
+                {
+                    WriteMeshValue(file, QuantizePosition(glm::vec3(vertex.pos), bounds));
+                }
+                else
+                {
+                    WriteMeshValue(file, glm::vec3(vertex.pos));
+                }
+                
+                auto color = ToColor(vertex.color);
+                WriteMeshValue(file, color);
+                WriteMeshValue(file, vertex.uv);
+            }
+        }
+        
+        return (bool)file;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+
+// the metadata at the start of a binary mesh file
+struct MeshHeader3D
+{
+    Uint32 triangle_count = 0;
+    MeshPositions3D positions = MeshPositions3D::Float;
+    AABB3D bounds;
+};
+
+
+// reads and checks the metadata of a binary mesh file, leaving the file at its first vertex (returns false if it isn't
+// a mesh file, or claims more triangles than the rest of the file has room for)
+inline bool ReadMeshHeader(std::ifstream& file, MeshHeader3D& out_header)
+{
+    char magic[4] = {};
+    Uint32 version = 0;
+    Uint8 positions = 0;
+    
+    if (!file || !file.read(magic, sizeof(magic)) || std::memcmp(magic, mesh_magic, sizeof(magic)) != 0)
+    { return false; }
+    
+    if (!ReadMeshValue(file, version) || version != mesh_version)
+    { return false; }
+    
+    if (!ReadMeshValue(file, out_header.triangle_count) || !ReadMeshValue(file, positions) || positions > (Uint8)MeshPositions3D::Quantized16)
+    { return false; }
+    
+    if (!ReadMeshValue(file, out_header.bounds.min) || !ReadMeshValue(file, out_header.bounds.max))
+    { return false; }
+    
+    out_header.positions = (MeshPositions3D)positions;
+    
+    // damaged files can claim any number of triangles, which shouldn't get allocated before finding out they aren't there
+    auto start = file.tellg();
+    file.seekg(0, std::ios::end);
+    auto remaining = (Uint64)(file.tellg() - start);
+    file.seekg(start);
+    
+    auto position_size = out_header.positions == MeshPositions3D::Quantized16 ? 3 * sizeof(Uint16) : sizeof(glm::vec3);
+    auto vertex_size = position_size + sizeof(Color3D) + sizeof(glm::vec2);
+    
+    return (bool)file && (Uint64)out_header.triangle_count * 3 * vertex_size <= remaining;
+}
+
+
+// loads a 3D model from a binary file written by SaveMesh (quantized positions are turned back into floats)
+inline std::optional<Model3D> LoadMesh(const fs::path& filepath)
+{
+    std::ifstream file(filepath, std::ios::binary);
+    MeshHeader3D header;
+    
+    // read and check metadata
+    if (!ReadMeshHeader(file, header))
+    { return std::nullopt; }
+    
+    Model3D model;
+    auto quantized = header.positions == MeshPositions3D::Quantized16;
+    auto to_model = GetDequantizeTransform(header.bounds);
+    
+    // read each triangle's data
+    model.triangles.resize(header.triangle_count);
+    
+    for (auto& triangle: model.triangles)
+    {
+        for (auto& vertex: triangle.vertices)
+        {
+            auto pos = glm::vec3(0.0f);
+            Color3D color;
+            
+            if (quantized)
+            {
+                std::array<Uint16, 3> quantized_pos;
+                
+                if (!ReadMeshValue(file, quantized_pos))
+                { return std::nullopt; }
+                
+                pos = glm::vec3(to_model * glm::vec4(quantized_pos[0], quantized_pos[1], quantized_pos[2], 1.0f));
+            }
+            else if (!ReadMeshValue(file, pos))
+            { return std::nullopt; }
+            
+            if (!ReadMeshValue(file, color) || !ReadMeshValue(file, vertex.uv))
+            { return std::nullopt; }
+            
+            vertex.pos = glm::vec4(pos, 1.0f);
+            vertex.color = ToVec4(color);
+        }
+    }
+    
+    // build the model's bounding volume hierarchy once, so ray queries don't have to
+    model.RebuildBVH();
+    
+    return model;
+}
+
+
+// loads a 3D model from a binary file written by SaveMesh, keeping its positions quantized in memory to halve the size
+// of its vertices (meshes saved with float positions get quantized while loading, which loses some precision)
+inline std::optional<QuantizedModel3D> LoadQuantizedMesh(const fs::path& filepath)
+{
+    std::ifstream file(filepath, std::ios::binary);
+    MeshHeader3D header;
+    
+    // read and check metadata
+    if (!ReadMeshHeader(file, header))
+    { return std::nullopt; }
+    
+    QuantizedModel3D model;
+    model.dequantize = GetDequantizeTransform(header.bounds);
+    
+    // read each triangle's data
+    model.triangles.resize(header.triangle_count);
+    
+    for (auto& triangle: model.triangles)
+    {
+        for (auto& vertex: triangle.vertices)
+        {
+            if (header.positions == MeshPositions3D::Quantized16)
+            {
+                if (!ReadMeshValue(file, vertex.pos))
+                { return std::nullopt; }
+            }
+            else
+            {
+                auto pos = glm::vec3(0.0f);
+                
+                if (!ReadMeshValue(file, pos))
+                { return std::nullopt; }
+                
+                vertex.pos = QuantizePosition(pos, header.bounds);
+            }
+            
+            if (!ReadMeshValue(file, vertex.color) || !ReadMeshValue(file, vertex.uv))
+            { return std::nullopt; }
+        }
+    }
+    
+    return model;
+}
\ No newline at end of file
@@ -0,0 +1,316 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <iomanip>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "color.hpp"
+
+
+// counts durations in microseconds with a fixed relative precision across a huge range of them, like HdrHistogram
+// does, so that rare slow frames are kept as precisely as common fast ones without storing every single one
+// (values under 256us are counted exactly, and bigger ones in buckets at most 1/128th of their value wide)
+struct FrameHistogram3D
+{
+    static constexpr int sub_bucket_bits = 8;
+    static constexpr Uint64 sub_bucket_count = 1 << sub_bucket_bits;
+    static constexpr Uint64 half_count = sub_bucket_count / 2;
+    
+    // values above this (about 19 hours) are counted as this
+    static constexpr int max_shift = 28;
+    static constexpr Uint64 max_value = (sub_bucket_count << max_shift) - 1;
+    
+    std::vector<Uint64> counts = std::vector<Uint64>(sub_bucket_count + max_shift * half_count, 0);
+    Uint64 total = 0;
+    Uint64 min = 0;
+    Uint64 max = 0;
+    double sum = 0.0;
+    double sum_squares = 0.0;
+    
+    // returns which bucket counts the given value
+    inline static size_t GetIndex(Uint64 value)
+    {
+        if (value < sub_bucket_count)
+        { return (size_t)value; }
+        
+        // shift values down until they fit in the upper half of the sub buckets
+        int shift = 0;
+        
+        while ((value >> shift) >= sub_bucket_count)
+        { shift += 1; }
+        
+        return (size_t)(sub_bucket_count + (shift - 1) * half_count + ((value >> shift) - half_count));
+    }
+    
+    // returns the highest value the given bucket counts
+    inline static Uint64 GetHighestValue(size_t index)
+    {
+        if (index < sub_bucket_count)
+        { return index; }
+        
+        auto shift = (int)((index - sub_bucket_count) / half_count) + 1;
+        auto sub_bucket = (index - sub_bucket_count) % half_count + half_count;
+        
+        return ((sub_bucket + 1) << shift) - 1;
+    }
+    
+    // counts a single value, in microseconds
+    inline void Record(Uint64 value)
+    {
+        value = std::min(value, max_value);
+        counts[GetIndex(value)] += 1;
+        
+        min = total == 0 ? value : std::min(min, value);
+        max = std::max(max, value);
+        total += 1;
+        sum += (double)value;
+        sum_squares += (double)value * (double)value;
+    }
+    
+    // counts a single duration
+    template<typename Rep, typename Period>
+    inline void Record(std::chrono::duration<Rep, Period> duration)
+    {
+        Record((Uint64)std::max<Rep>(0, std::chrono::duration_cast<std::chrono::duration<Rep, std::micro>>(duration).count()));
+    }
+    
+    // forgets every value counted so far
+    inline void Reset()
+    {
+        std::fill(counts.begin(), counts.end(), 0);
+        total = min = max = 0;
+        sum = sum_squares = 0.0;
+    }
+    
+    // returns the value the given percentage of values are at or below, in microseconds (0 if nothing was counted)
+    inline Uint64 GetPercentile(double percentile) const
+    {
+        auto wanted = std::max<Uint64>(1, (Uint64)std::ceil(std::clamp(percentile, 0.0, 100.0) / 100.0 * (double)total));
+        Uint64 counted = 0;
+        
+        for (size_t i = 0; i < counts.size() && total > 0; ++i)
+        {
+            counted += counts[i];
+            
+            if (counted >= wanted)
+            { return std::min(GetHighestValue(i), max); }
+        }
+        
+        return max;
+    }
+    
+    // returns the average value, in microseconds
+    inline double GetMean() const
+    {
+        return total > 0 ? sum / (double)total : 0.0;
+    }
+    
+    // writes the distribution of values in milliseconds in the same text format HdrHistogram writes, which its plotting
+    // tools can read, with five steps every time the distance to 100% halves
+    inline void Write(std::ostream& out) const
+    {
+        auto flags = out.flags();
+        auto precision = out.precision();
+        
+        out << std::setw(12) << "Value" << " " << std::setw(14) << "Percentile" << " " << std::setw(10) << "TotalCount";
+        out << " " << std::setw(14) << "1/(1-Percentile)" << "\n\n";
+        
+        Uint64 counted = 0;
+        size_t index = 0;
+        
+        for (int step = 0; total > 0; ++step)
+        {
+            auto percentile = 100.0 * (1.0 - std::pow(0.5, step / 5.0));
+            auto value = GetPercentile(percentile);
+            auto last = value >= max || step >= 5 * 40;
+            
+            if (last)
+            { percentile = 100.0; }
+            
+            while (index < counts.size() && index <= GetIndex(value))
+            { counted += counts[index++]; }
+            
+            out << std::fixed << std::setprecision(3) << std::setw(12) << value / 1000.0 << " ";
+            out << std::setprecision(12) << std::setw(14) << percentile / 100.0 << " " << std::setw(10) << std::min(counted, total);
+            
+            if (!last)
+            { out << " " << std::setprecision(2) << std::setw(14) << 1.0 / (1.0 - percentile / 100.0); }
+            
+            out << "\n";
+            
+            if (last)
+            { break; }
+        }
+        
+        auto mean = GetMean();
+        auto deviation = total > 0 ? std::sqrt(std::max(0.0, sum_squares / (double)total - mean * mean)) : 0.0;
+        
+        out << std::setprecision(3);
+        out << "#[Mean    = " << std::setw(12) << mean / 1000.0 << ", StdDeviation   = " << std::setw(12) << deviation / 1000.0 << "]\n";
+        out << "#[Max     = " << std::setw(12) << max / 1000.0 << ", Total count    = " << std::setw(12) << total << "]\n";
+        out << "#[Buckets = " << std::setw(12) << max_shift << ", SubBuckets     = " << std::setw(12) << sub_bucket_count << "]\n";
+        
+        out.flags(flags);
+        out.precision(precision);
+    }
+};
+
+
+// returns the flag the dump signal sets (volatile and lock free, since it's written from a signal handler)
+inline volatile std::sig_atomic_t& GetDumpRequestFlag()
+{
+    static volatile std::sig_atomic_t requested = 0;
+    return requested;
+}
+
+
+// makes SIGUSR1 ask for histograms to be dumped (returns false where that signal doesn't exist, like on Windows)
+inline bool InstallDumpSignal()
+{
+#if defined(SIGUSR1)
+    std::signal(SIGUSR1, [](int) { GetDumpRequestFlag() = 1; });
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+// paces frames to a fixed interval without relying on vsync, and keeps histograms of how long frames took, how much of
+// that was rendering, and how much was waiting
+// (frames sleep at the start, before input is read, until just early enough to finish rendering by their deadline, so
+// input is as fresh as possible when presented, then spin for whatever is left over right before presenting)
+// (call BeginFrame at the start of every frame, EndRender once it's drawn, and WaitToPresent right before presenting it)
+struct FramePacer3D
+{
+    using Clock = std::chrono::steady_clock;
+    
+    // how many of the most recent render times the next one is predicted from
+    static constexpr size_t render_history_size = 8;
+    
+    // how long frames should take (zero means as fast as possible, in which case nothing waits)
+    Clock::duration interval = Clock::duration::zero();
+    
+    // how much earlier than the predicted render time frames wake up, since sleeps often overshoot by a millisecond or
+    // so (which is about how long the spin before presenting takes, when renders take as long as predicted)
+    Clock::duration spin_margin = std::chrono::microseconds(1500);
+    
+    FrameHistogram3D frame_times;
+    FrameHistogram3D render_times;
+    FrameHistogram3D wait_times;
+    
+    // the most recent render times, with the next one overwriting the oldest
+    std::array<Clock::duration, render_history_size> render_history{};
+    size_t render_count = 0;
+    
+    // when the current frame started, started and finished rendering, how long it waited, and when it's due
+    Clock::time_point frame_start;
+    Clock::time_point render_start;
+    Clock::time_point render_end;
+    Clock::time_point next_deadline;
+    Clock::duration waited = Clock::duration::zero();
+    bool started = false;
+    
+    // paces frames to the given number per second (0 or less turns pacing off)
+    inline void SetTargetRate(double frames_per_second)
+    {
+        interval = frames_per_second > 0.0 ?
+            std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / frames_per_second)) :
+            Clock::duration::zero();
+    }
+    
+    // returns how long the next frame is expected to take to render (the slowest of the recent ones, to be safe)
+    inline Clock::duration GetRenderEstimate() const
+    {
+        auto end = render_history.begin() + std::min(render_count, render_history_size);
+        return render_count > 0 ? *std::max_element(render_history.begin(), end) : Clock::duration::zero();
+    }
+    
+    // starts a frame, counting how long the previous one took and waited, then sleeps until it's time to render this one
+    // if frames are paced (frames running more than a whole interval late start a new schedule rather than rushing to
+    // catch up)
+    inline void BeginFrame()
+    {
+        auto now = Clock::now();
+        
+        if (started)
+        {
+            frame_times.Record(now - frame_start);
+            wait_times.Record(waited);
+        }
+        
+        frame_start = now;
+        waited = Clock::duration::zero();
+        started = true;
+        
+        if (interval > Clock::duration::zero())
+        {
+            auto lead = GetRenderEstimate() + spin_margin;
+            
+            if (now + lead > next_deadline + interval)
+            { next_deadline = now + lead; }
+            
+            if (next_deadline - lead > now)
+            { std::this_thread::sleep_until(next_deadline - lead); }
+        }
+        
+        render_start = Clock::now();
+        render_end = render_start;
+        waited += render_start - now;
+    }
+    
+    // notes that the current frame is drawn, and only needs presenting
+    inline void EndRender()
+    {
+        render_end = Clock::now();
+        
+        auto render_time = render_end - render_start;
+        render_times.Record(render_time);
+        render_history[render_count % render_history_size] = render_time;
+        render_count += 1;
+    }
+    
+    // spins until the current frame is due if frames are paced, which only takes as long as rendering came in under its
+    // prediction plus the spin margin, and schedules the next one
+    inline void WaitToPresent()
+    {
+        if (interval <= Clock::duration::zero())
+        { return; }
+        
+        auto start = Clock::now();
+        
+        while (Clock::now() < next_deadline)
+        {
+            std::this_thread::yield();
+        }
+        
+        waited += Clock::now() - start;
+        next_deadline += interval;
+    }
+    
+    // returns whether the dump signal arrived since the last time this was asked, and forgets it if so
+    inline bool TakeDumpRequest()
+    {
+        if (GetDumpRequestFlag() == 0)
+        { return false; }
+        
+        GetDumpRequestFlag() = 0;
+        return true;
+    }
+    
+    // writes every histogram, one after another
+    inline void WriteHistograms(std::ostream& out) const
+    {
+        out << "# frame time (ms)\n";
+        frame_times.Write(out);
+        out << "\n# render time (ms)\n";
+        render_times.Write(out);
+        out << "\n# wait time (ms)\n";
+        wait_times.Write(out);
+    }
+};
\ No newline at end of file
@@ -0,0 +1,141 @@
+#pragma once
+#include <array>
+#include <algorithm>
+#include <vector>
+
+#include "color.hpp"
+#include "math.hpp"
+
+
+// a shared 256 color palette, along with the lookup tables needed to render into 8 bit images without ever leaving them
+// (pixels and texels are stored as one byte indices, which is a quarter of the memory traffic of 32 bit colors)
+struct Palette3D
+{
+    // number of levels per channel used by the inverse lookup table
+    static constexpr int inverse_levels = 32;
+    
+    std::array<Color3D, 256> colors;
+    
+    // finds the closest palette index for a color quantized to inverse_levels per channel
+    std::vector<Uint8> inverse;
+    
+    // finds the palette index closest to the product of two palette colors (256 x 256 entries)
+    std::vector<Uint8> modulate;
+    
+    // how far apart, in 0-255 units, ordered dithering spreads colors before matching them
+    int dither_spread = 48;
+    
+    // constructs the default palette, a 6x6x6 color cube followed by a ramp of 40 grays
+    inline Palette3D()
+    {
+        size_t i = 0;
+        
+        for (int r = 0; r < 6; ++r)
+        for (int g = 0; g < 6; ++g)
+        for (int b = 0; b < 6; ++b)
+        {
+            colors[i++] = Color3D{ (Uint8)(r * 51), (Uint8)(g * 51), (Uint8)(b * 51), 255 };
+        }
+        
+        // evenly spaced grays, since shading mostly darkens colors towards black
+        for (int g = 1; i < colors.size(); ++g)
+        {
+            auto level = (Uint8)(g * 255 / 41);
+            colors[i++] = Color3D{ level, level, level, 255 };
+        }
+        
+        BuildTables();
+    }
+    
+    // constructs a palette from the given colors
+    inline Palette3D(const std::array<Color3D, 256>& colors):
+        colors(colors)
+    {
+        BuildTables();
+    }
+    
+    // palettes have big tables and images point to the palette they use, so they are shared by pointer rather than copied
+    Palette3D(const Palette3D&) = delete;
+    Palette3D& operator=(const Palette3D&) = delete;
+    
+    // builds every lookup table from the palette's colors (call again after changing them)
+    inline void BuildTables()
+    {
+        // the closest color to each cell of a coarse color cube, found by brute force once instead of once per pixel
+        inverse.resize(inverse_levels * inverse_levels * inverse_levels);
+        
+        for (int r = 0; r < inverse_levels; ++r)
+        for (int g = 0; g < inverse_levels; ++g)
+        for (int b = 0; b < inverse_levels; ++b)
+        {
+            auto scale = inverse_levels - 1;
+            inverse[(r * inverse_levels + g) * inverse_levels + b] = FindClosest(r * 255 / scale, g * 255 / scale, b * 255 / scale);
+        }
+        
+        // products of every pair of colors, so that modulating a texel by a vertex color is a single lookup
+        modulate.resize(colors.size() * colors.size());
+        
+        for (size_t a = 0; a < colors.size(); ++a)
+        {
+            for (size_t b = 0; b < colors.size(); ++b)
+            {
+                auto color = Blend(colors[a], colors[b]);
+                modulate[a * colors.size() + b] = FindClosest(color.r, color.g, color.b);
+            }
+        }
+    }
+    
+    // finds the index of the closest color by checking every one of them (slow, only used to build tables)
+    inline Uint8 FindClosest(int r, int g, int b) const
+    {
+        size_t best = 0;
+        int best_distance = 1 << 30;
+        
+        for (size_t i = 0; i < colors.size(); ++i)
+        {
+            auto dr = colors[i].r - r;
+            auto dg = colors[i].g - g;
+            auto db = colors[i].b - b;
+            auto distance = dr * dr + dg * dg + db * db;
+            
+            if (distance < best_distance)
+            {
+                best = i;
+                best_distance = distance;
+            }
+        }
+        
+        return (Uint8)best;
+    }
+    
+    // finds the index of the palette color closest to the given color
+    inline Uint8 Match(int r, int g, int b) const
+    {
+        auto scale = inverse_levels - 1;
+        auto ri = (std::clamp(r, 0, 255) * scale + 127) / 255;
+        auto gi = (std::clamp(g, 0, 255) * scale + 127) / 255;
+        auto bi = (std::clamp(b, 0, 255) * scale + 127) / 255;
+        
+        return inverse[(ri * inverse_levels + gi) * inverse_levels + bi];
+    }
+    
+    // finds the index of the palette color closest to the given color
+    inline Uint8 Match(const Color3D& color) const
+    {
+        return Match(color.r, color.g, color.b);
+    }
+    
+    // finds the index of a palette color for the given pixel, nudged by a 4x4 ordered dither pattern so that smooth
+    // gradients come out as a fine pattern of the palette colors around them instead of visible bands
+    inline Uint8 MatchDithered(const Color3D& color, int x, int y) const
+    {
+        auto offset = GetDitherThreshold(x, y) * dither_spread / 32;
+        return Match(color.r + offset, color.g + offset, color.b + offset);
+    }
+    
+    // finds the index of the palette color closest to the product of two palette colors
+    inline Uint8 Modulate(Uint8 a, Uint8 b) const
+    {
+        return modulate[a * colors.size() + b];
+    }
+};
\ No newline at end of file
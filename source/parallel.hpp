@@ -0,0 +1,280 @@
+#pragma once
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+// a group of cpus that share the same memory, which threads running on them read and write faster than other memory
+struct NumaNode3D
+{
+    int id = 0;
+    std::vector<int> cpus;
+};
+
+
+// parses a list of cpus or nodes the way Linux writes them, like "0-3,8,10-11"
+inline std::vector<int> ParseCpuList(const std::string& list)
+{
+    std::vector<int> cpus;
+    std::stringstream stream(list);
+    std::string range;
+    
+    while (std::getline(stream, range, ','))
+    {
+        if (range.find_first_of("0123456789") == std::string::npos)
+        { continue; }
+        
+        auto dash = range.find('-');
+        auto first = std::atoi(range.c_str());
+        auto last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+        
+        for (int cpu = first; cpu <= last; ++cpu)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    
+    return cpus;
+}
+
+
+// returns the NUMA nodes of this machine along with their cpus, as Linux reports them
+// (elsewhere, or if Linux doesn't say, the whole machine is a single node holding every hardware thread)
+inline const std::vector<NumaNode3D>& GetNumaNodes()
+{
+    static const std::vector<NumaNode3D> nodes = []()
+    {
+        std::vector<NumaNode3D> found;
+
+#if defined(__linux__)
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string list;
+        
+        if (online && std::getline(online, list))
+        {
+            for (auto id: ParseCpuList(list))
+            {
+                std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+                std::string cpus;
+                
+                // nodes with memory but no cpus can't run anything
+                if (cpulist && std::getline(cpulist, cpus) && !ParseCpuList(cpus).empty())
+                { found.push_back(NumaNode3D{ id, ParseCpuList(cpus) }); }
+            }
+        }
+#endif
+
+        if (found.empty())
+        {
+            NumaNode3D node;
+            
+            for (int cpu = 0; cpu < (int)std::max(1u, std::thread::hardware_concurrency()); ++cpu)
+            {
+                node.cpus.push_back(cpu);
+            }
+            
+            found.push_back(node);
+        }
+        
+        return found;
+    }();
+    
+    return nodes;
+}
+
+
+// how ParallelFor spreads work across threads and cores
+struct ThreadPlacement3D
+{
+    // how many threads to split work across (0 means one per cpu in cpus, or per hardware thread if that's empty)
+    size_t threads = 0;
+    
+    // whether every thread gets pinned to a single cpu, so that the same chunk of work always runs next to the memory
+    // it touched last time (only supported on Linux)
+    bool pin = false;
+    
+    // which cpus threads run on, in the order chunks of work are handed to them (empty means every cpu, node by node)
+    std::vector<int> cpus;
+};
+
+
+// reads a thread placement from the environment:
+// SMOLSOFT3D_THREADS sets how many threads to use, SMOLSOFT3D_PIN=1 pins them, SMOLSOFT3D_CPUS lists which cpus to
+// use (like "0-7,16-23"), and SMOLSOFT3D_NUMA_NODES uses every cpu of the listed nodes instead
+inline ThreadPlacement3D GetThreadPlacementFromEnvironment()
+{
+    ThreadPlacement3D placement;
+    
+    if (auto threads = std::getenv("SMOLSOFT3D_THREADS"))
+    { placement.threads = (size_t)std::max(0, std::atoi(threads)); }
+    
+    if (auto pin = std::getenv("SMOLSOFT3D_PIN"))
+    { placement.pin = std::atoi(pin) != 0; }
+    
+    if (auto cpus = std::getenv("SMOLSOFT3D_CPUS"))
+    { placement.cpus = ParseCpuList(cpus); }
+    else if (auto nodes = std::getenv("SMOLSOFT3D_NUMA_NODES"))
+    {
+        for (auto id: ParseCpuList(nodes))
+        {
+            for (auto& node: GetNumaNodes())
+            {
+                if (node.id == id)
+                { placement.cpus.insert(placement.cpus.end(), node.cpus.begin(), node.cpus.end()); }
+            }
+        }
+    }
+    
+    return placement;
+}
+
+
+// returns the placement ParallelFor uses, which is read from the environment the first time it's needed
+inline ThreadPlacement3D& GetThreadPlacement()
+{
+    static ThreadPlacement3D placement = GetThreadPlacementFromEnvironment();
+    return placement;
+}
+
+
+// changes the placement ParallelFor uses (must not be called while any ParallelFor is running)
+inline void SetThreadPlacement(const ThreadPlacement3D& placement)
+{
+    GetThreadPlacement() = placement;
+}
+
+
+// returns the cpus threads run on, in the order chunks of work are handed to them
+// (cpus of the same node come one after another, so neighboring chunks of work share a node)
+inline std::vector<int> GetWorkerCpus()
+{
+    auto& placement = GetThreadPlacement();
+    
+    if (!placement.cpus.empty())
+    { return placement.cpus; }
+    
+    std::vector<int> cpus;
+    
+    for (auto& node: GetNumaNodes())
+    {
+        cpus.insert(cpus.end(), node.cpus.begin(), node.cpus.end());
+    }
+    
+    return cpus;
+}
+
+
+// returns how many threads parallel work should be split across
+inline size_t GetWorkerCount()
+{
+    auto& placement = GetThreadPlacement();
+    
+    if (placement.threads > 0)
+    { return placement.threads; }
+    
+    if (!placement.cpus.empty())
+    { return placement.cpus.size(); }
+    
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+
+// pins the calling thread to the given cpus (returns false if that isn't supported, or the cpus don't exist)
+inline bool PinThread(const std::vector<int>& cpus)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    
+    for (auto cpu: cpus)
+    {
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+        { CPU_SET(cpu, &set); }
+    }
+    
+    return CPU_COUNT(&set) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+
+// splits the range [0, count) into contiguous chunks and processes each of them on its own thread
+// (the calling thread processes the first chunk itself, and this only returns once every chunk is done)
+// (with pinned placements, the chunk at each index always runs on the same cpu as long as as many threads are used, so
+// memory first written by a chunk ends up on the node that keeps working on it, and the calling thread gets its own
+// cpus back afterwards)
+inline void ParallelFor(size_t count, const std::function<void(size_t, size_t)>& work)
+{
+    auto thread_count = std::min(GetWorkerCount(), count);
+    
+    if (thread_count <= 1)
+    {
+        work(0, count);
+        return;
+    }
+    
+    auto chunk_size = (count + thread_count - 1) / thread_count;
+    auto pin = GetThreadPlacement().pin;
+    auto cpus = pin ? GetWorkerCpus() : std::vector<int>();
+    
+    auto run = [&](size_t chunk, size_t begin)
+    {
+        // chunks are spread evenly over the cpus, so fewer threads than cpus still use every node
+        if (!cpus.empty())
+        { PinThread({ cpus[chunk * cpus.size() / thread_count % cpus.size()] }); }
+        
+        work(begin, std::min(begin + chunk_size, count));
+    };
+    
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    
+    for (size_t begin = chunk_size; begin < count; begin += chunk_size)
+    {
+        threads.emplace_back(run, begin / chunk_size, begin);
+    }
+
+#if defined(__linux__)
+    cpu_set_t previous;
+    auto restore = !cpus.empty() && pthread_getaffinity_np(pthread_self(), sizeof(previous), &previous) == 0;
+#endif
+
+    run(0, 0);
+
+#if defined(__linux__)
+    if (restore)
+    { pthread_setaffinity_np(pthread_self(), sizeof(previous), &previous); }
+#endif
+
+    for (auto& thread: threads)
+    {
+        thread.join();
+    }
+}
+
+
+// runs the given work on a thread pinned to the given node and waits for it, so that everything the work allocates
+// and first writes to (like a batch job's target and assets) ends up in that node's memory
+// (without pinning support, the work just runs on a thread of its own)
+inline void RunOnNumaNode(const NumaNode3D& node, const std::function<void()>& work)
+{
+    std::thread thread([&]()
+    {
+        PinThread(node.cpus);
+        work();
+    });
+    
+    thread.join();
+}
\ No newline at end of file
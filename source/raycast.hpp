@@ -0,0 +1,261 @@
+#pragma once
+#include <array>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtx/rotate_vector.hpp>
+
+#include "math.hpp"
+#include "bvh.hpp"
+#include "parallel.hpp"
+#include "renderer.hpp"
+
+
+// a ray in 3D space, which only finds hits up to max_distance times the length of its direction
+struct Ray3D
+{
+    glm::vec3 origin;
+    glm::vec3 direction;
+    float max_distance = std::numeric_limits<float>::infinity();
+};
+
+
+// the closest point at which a ray hit a model
+struct RayHit3D
+{
+    // distance along the ray, in multiples of its direction
+    float distance = std::numeric_limits<float>::infinity();
+    
+    // index of the triangle that was hit within the model
+    size_t triangle = 0;
+    
+    // weights of the triangle's second and third vertices at the hit point
+    glm::vec2 barycentric{ 0.0f, 0.0f };
+    
+    // world space position of the hit
+    glm::vec3 pos{ 0.0f, 0.0f, 0.0f };
+};
+
+
+// finds the distance at which a ray enters a box, or infinity if it misses it before max_distance
+inline float IntersectBox(const AABB3D& box, const glm::vec3& origin, const glm::vec3& inv_direction, float max_distance)
+{
+    // slab test, written without branches so it compiles down to a handful of vector min/max operations
+    auto t0 = (box.min - origin) * inv_direction;
+    auto t1 = (box.max - origin) * inv_direction;
+    auto t_near = glm::min(t0, t1);
+    auto t_far = glm::max(t0, t1);
+    
+    auto enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, 0.0f));
+    auto exit = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, max_distance));
+    
+    return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+}
+
+
+// finds where a ray hits a triangle using the Moller-Trumbore algorithm, and writes it into hit if it is closer than hit.distance
+inline bool IntersectTriangle(const Triangle3D& triangle, const glm::vec3& origin, const glm::vec3& direction, RayHit3D& hit)
+{
+    constexpr float epsilon = 1e-8f;
+    
+    auto pos0 = glm::vec3(triangle.vertices[0].pos);
+    auto edge1 = glm::vec3(triangle.vertices[1].pos) - pos0;
+    auto edge2 = glm::vec3(triangle.vertices[2].pos) - pos0;
+    
+    auto p = glm::cross(direction, edge2);
+    auto det = glm::dot(edge1, p);
+    
+    // rays parallel to the triangle never hit it (both sides of a triangle can be hit)
+    if (std::abs(det) < epsilon)
+    { return false; }
+    
+    auto inv_det = 1.0f / det;
+    auto s = origin - pos0;
+    auto u = glm::dot(s, p) * inv_det;
+    
+    if (u < 0.0f || u > 1.0f)
+    { return false; }
+    
+    auto q = glm::cross(s, edge1);
+    auto v = glm::dot(direction, q) * inv_det;
+    
+    if (v < 0.0f || u + v > 1.0f)
+    { return false; }
+    
+    auto t = glm::dot(edge2, q) * inv_det;
+    
+    if (t < 0.0f || t >= hit.distance)
+    { return false; }
+    
+    hit.distance = t;
+    hit.barycentric = glm::vec2(u, v);
+    return true;
+}
+
+
+// walks the given model's bounding volume hierarchy with a model space ray, nearest nodes first
+// (when any_hit is true, this stops at the first hit it finds instead of looking for the closest one)
+inline bool TraceModel(const Model3D& model, const glm::vec3& origin, const glm::vec3& direction, bool any_hit, RayHit3D& hit)
+{
+    auto& bvh = model.bvh;
+    
+    if (bvh.IsEmpty())
+    { return false; }
+    
+    auto inv_direction = 1.0f / direction;
+    
+    if (IntersectBox(bvh.nodes[0].bounds, origin, inv_direction, hit.distance) == std::numeric_limits<float>::infinity())
+    { return false; }
+    
+    // every level walked down leaves at most one sibling behind, and BuildBVH caps how many levels there are
+    std::array<uint32_t, max_bvh_depth + 1> stack;
+    size_t stack_size = 0;
+    stack[stack_size++] = 0;
+    
+    bool found = false;
+    
+    while (stack_size > 0)
+    {
+        auto& node = bvh.nodes[stack[--stack_size]];
+        
+        if (node.IsLeaf())
+        {
+            for (auto i = node.first; i < node.first + node.count; ++i)
+            {
+                auto triangle_i = bvh.indices[i];
+                
+                if (IntersectTriangle(model.triangles[triangle_i], origin, direction, hit))
+                {
+                    hit.triangle = triangle_i;
+                    found = true;
+                    
+                    if (any_hit)
+                    { return true; }
+                }
+            }
+        }
+        else
+        {
+            // visit the closest child first so that hits found there can cull the other one
+            auto near_i = node.first;
+            auto far_i = node.first + 1;
+            auto near_t = IntersectBox(bvh.nodes[near_i].bounds, origin, inv_direction, hit.distance);
+            auto far_t = IntersectBox(bvh.nodes[far_i].bounds, origin, inv_direction, hit.distance);
+            
+            if (far_t < near_t)
+            {
+                std::swap(near_i, far_i);
+                std::swap(near_t, far_t);
+            }
+            
+            if (far_t != std::numeric_limits<float>::infinity())
+            { stack[stack_size++] = far_i; }
+            
+            if (near_t != std::numeric_limits<float>::infinity())
+            { stack[stack_size++] = near_i; }
+        }
+    }
+    
+    return found;
+}
+
+
+// finds the closest point at which the given world space ray hits the given model drawn with the given transform
+inline std::optional<RayHit3D> Raycast(const Model3D& model, const glm::mat4& transform, const Ray3D& ray)
+{
+    // bring the ray into model space instead of bringing every triangle into world space (this preserves distances along the ray)
+    auto inv_transform = glm::inverse(transform);
+    auto origin = glm::vec3(inv_transform * glm::vec4(ray.origin, 1.0f));
+    auto direction = glm::vec3(inv_transform * glm::vec4(ray.direction, 0.0f));
+    
+    RayHit3D hit;
+    hit.distance = ray.max_distance;
+    
+    if (!TraceModel(model, origin, direction, false, hit))
+    { return std::nullopt; }
+    
+    hit.pos = ray.origin + ray.direction * hit.distance;
+    return hit;
+}
+
+
+// checks whether the given world space ray hits anything at all in the given model, which is cheaper than finding the closest hit
+// (useful for line of sight checks, with a ray going from one point to the other and a max_distance of 1)
+inline bool Occluded(const Model3D& model, const glm::mat4& transform, const Ray3D& ray)
+{
+    auto inv_transform = glm::inverse(transform);
+    auto origin = glm::vec3(inv_transform * glm::vec4(ray.origin, 1.0f));
+    auto direction = glm::vec3(inv_transform * glm::vec4(ray.direction, 0.0f));
+    
+    RayHit3D hit;
+    hit.distance = ray.max_distance;
+    
+    return TraceModel(model, origin, direction, true, hit);
+}
+
+
+// finds the closest hit of every given ray against the given model, spread across every core
+inline std::vector<std::optional<RayHit3D>> RaycastBatch(const Model3D& model, const glm::mat4& transform, const std::vector<Ray3D>& rays)
+{
+    std::vector<std::optional<RayHit3D>> hits(rays.size());
+    auto inv_transform = glm::inverse(transform);
+    
+    ParallelFor(rays.size(), [&](size_t begin, size_t end)
+    {
+        for (auto r = begin; r < end; ++r)
+        {
+            auto& ray = rays[r];
+            auto origin = glm::vec3(inv_transform * glm::vec4(ray.origin, 1.0f));
+            auto direction = glm::vec3(inv_transform * glm::vec4(ray.direction, 0.0f));
+            
+            RayHit3D hit;
+            hit.distance = ray.max_distance;
+            
+            if (TraceModel(model, origin, direction, false, hit))
+            {
+                hit.pos = ray.origin + ray.direction * hit.distance;
+                hits[r] = hit;
+            }
+        }
+    });
+    
+    return hits;
+}
+
+
+// checks whether each of the given rays hits anything in the given model, spread across every core
+inline std::vector<bool> OccludedBatch(const Model3D& model, const glm::mat4& transform, const std::vector<Ray3D>& rays)
+{
+    // bytes rather than a std::vector<bool> so that threads never write to the same memory
+    std::vector<Uint8> occluded(rays.size(), 0);
+    auto inv_transform = glm::inverse(transform);
+    
+    ParallelFor(rays.size(), [&](size_t begin, size_t end)
+    {
+        for (auto r = begin; r < end; ++r)
+        {
+            auto& ray = rays[r];
+            auto origin = glm::vec3(inv_transform * glm::vec4(ray.origin, 1.0f));
+            auto direction = glm::vec3(inv_transform * glm::vec4(ray.direction, 0.0f));
+            
+            RayHit3D hit;
+            hit.distance = ray.max_distance;
+            
+            occluded[r] = TraceModel(model, origin, direction, true, hit);
+        }
+    });
+    
+    return std::vector<bool>(occluded.begin(), occluded.end());
+}
+
+
+// creates a world space ray going from the camera through the given point on the screen (useful for mouse picking)
+inline Ray3D ScreenRay(const Camera3D& camera, const Screen& screen, float x, float y)
+{
+    auto view_pos = UnscaleFromScreen(glm::vec3(x, y, 1.0f), screen);
+    auto direction = TranslateToWorld(view_pos, camera) - camera.pos;
+    
+    return Ray3D{ camera.pos, glm::normalize(direction) };
+}
\ No newline at end of file
@@ -1,11 +1,17 @@
 #pragma once
 #include <filesystem>
+#include <limits>
 namespace fs = std::filesystem;
 
-#include <SDL2/SDL.h>
 #include <glm/glm.hpp>
 
+#include "color.hpp"
 #include "math.hpp"
+#include "bvh.hpp"
+#include "image.hpp"
+#include "simd.hpp"
+#include "tiled.hpp"
+#include "virtual.hpp"
 
 
 // a vertex in 3D space with w scaling, color, and uv information
@@ -30,7 +36,7 @@ struct Vertex3D
     {}
     
     // constructs a vertex from a 3D point and color
-    inline constexpr Vertex3D(const glm::vec3& pos, const SDL_Color& color):
+    inline constexpr Vertex3D(const glm::vec3& pos, const Color3D& color):
         pos(pos, 1.0f),
         color(ToVec4(color)),
         uv(0.0f, 0.0f)
@@ -44,7 +50,7 @@ struct Vertex3D
     {}
     
     // constructs a vertex from a 3D point, color, and texture coordinate
-    inline constexpr Vertex3D(const glm::vec3& pos, const SDL_Color& color, const glm::vec2& uv):
+    inline constexpr Vertex3D(const glm::vec3& pos, const Color3D& color, const glm::vec2& uv):
         pos(pos, 1.0f),
         color(ToVec4(color)),
         uv(uv)
@@ -77,6 +83,12 @@ struct Vertex3D
         auto w = pos.w;
         return Vertex3D(glm::vec4(pos.x / w, pos.y / w, pos.z / w, 1.0f), color / w, uv / w);
     }
+    
+    // restores a value after it has been interpolated by multiplying every value by the given reciprocal of pos.w
+    inline constexpr Vertex3D Restore(float inv_w) const
+    {
+        return Vertex3D(glm::vec4(pos.x * inv_w, pos.y * inv_w, pos.z * inv_w, 1.0f), color * inv_w, uv * inv_w);
+    }
 };
 
 
@@ -102,10 +114,89 @@ struct Triangle3D
 };
 
 
-// contains all the triangles of a 3D model
+// contains all the triangles of a 3D model, along with a hierarchy of their bounds used for ray queries
 struct Model3D
 {
     std::vector<Triangle3D> triangles;
+    BVH3D bvh;
+    
+    // rebuilds the bounding volume hierarchy of this model (needs to be called whenever its triangles change)
+    inline void RebuildBVH()
+    {
+        std::vector<AABB3D> bounds(triangles.size());
+        
+        for (size_t t = 0; t < triangles.size(); ++t)
+        {
+            for (auto& vertex: triangles[t].vertices)
+            {
+                bounds[t].Grow(glm::vec3(vertex.pos));
+            }
+        }
+        
+        bvh = BuildBVH(bounds);
+    }
+};
+
+
+// a single vertex of a quantized model, whose position is stored as 16 bit integers spread across the model's bounds
+// (half the size of a Vertex3D)
+struct QuantizedVertex3D
+{
+    std::array<Uint16, 3> pos{};
+    Color3D color{ 255, 255, 255, 255 };
+    glm::vec2 uv = glm::vec2(0.0f);
+    
+    // expands this vertex into a regular one, with its position still in quantized units
+    inline Vertex3D Expand() const
+    {
+        return Vertex3D(glm::vec3(pos[0], pos[1], pos[2]), color, uv);
+    }
+};
+
+
+// contains the 3 vertices of a single quantized triangle
+struct QuantizedTriangle3D
+{
+    std::array<QuantizedVertex3D, 3> vertices;
+    
+    // expands this triangle into a regular one, with its positions still in quantized units
+    inline Triangle3D Expand() const
+    {
+        return Triangle3D{ { vertices[0].Expand(), vertices[1].Expand(), vertices[2].Expand() } };
+    }
+};
+
+
+// contains all the triangles of a 3D model whose positions stay quantized in memory, along with the matrix that turns
+// them into model space, which gets folded into the transform every draw already multiplies positions by
+// (only Renderer3D::Blit3DModel draws these, anything else, like ray queries, collision, command buffers or setup
+// caches, needs the Model3D that Dequantize makes)
+struct QuantizedModel3D
+{
+    std::vector<QuantizedTriangle3D> triangles;
+    glm::mat4 dequantize = glm::mat4(1.0f);
+    
+    // makes a regular model in model space out of this one, with its bounding volume hierarchy built
+    inline Model3D Dequantize() const
+    {
+        Model3D model;
+        model.triangles.reserve(triangles.size());
+        
+        for (auto& quantized: triangles)
+        {
+            auto triangle = quantized.Expand();
+            
+            for (auto& vertex: triangle.vertices)
+            {
+                vertex.pos = dequantize * vertex.pos;
+            }
+            
+            model.triangles.push_back(triangle);
+        }
+        
+        model.RebuildBVH();
+        return model;
+    }
 };
 
 
@@ -168,6 +259,9 @@ inline std::optional<Model3D> LoadModel(const fs::path& filepath)
             model.triangles.push_back(triangle);
         }
         
+        // build the model's bounding volume hierarchy once, so ray queries don't have to
+        model.RebuildBVH();
+        
         // return our result
         return model;
     }
@@ -188,6 +282,41 @@ inline void TryLoadModel(const fs::path& filepath, Model3D& out_model)
 }
 
 
+// saves a 3D model to a text file in the format read by LoadModel (always with every vertex attribute)
+inline bool SaveModel(const fs::path& filepath, const Model3D& model)
+{
+    if (std::ofstream file(filepath); file)
+    {
+        // positions and uvs are written with enough digits to read back exactly the same floats
+        file.precision(std::numeric_limits<float>::max_digits10);
+        
+        // write metadata and format
+        file << model.triangles.size() << " 3 pos color uv\n";
+        
+        // write each triangle's data
+        for (auto& triangle: model.triangles)
+        {
+            file << "\n";
+            
+            for (auto& vertex: triangle.vertices)
+            {
+                auto color = ToColor(vertex.color);
+                
+                file << vertex.pos.x << " " << vertex.pos.y << " " << vertex.pos.z << "   ";
+                file << (int)color.r << " " << (int)color.g << " " << (int)color.b << " " << (int)color.a << "   ";
+                file << vertex.uv.x << " " << vertex.uv.y << "\n";
+            }
+        }
+        
+        return (bool)file;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+
 // contains the position and rotation of a camera in 3D space
 struct Camera3D
 {
@@ -203,14 +332,27 @@ struct Camera3D
         yaw = Clamp(yaw, -89.9f, 89.9f);
     }
     
+    // finds the world space motion that moving along three axes aligned with the camera's pitch would result in
+    inline glm::vec3 GetMotion(float advance, float strafe, float ascend) const
+    {
+        return glm::rotateY(glm::vec3(strafe, ascend, advance), -glm::radians(pitch));
+    }
+    
     // moves the camera along three axes aligned with the camera's pitch
     inline void Move(float advance, float strafe, float ascend)
     {
-        pos += glm::rotateY(glm::vec3(strafe, ascend, advance), -glm::radians(pitch));
+        pos += GetMotion(advance, strafe, ascend);
     }
 };
 
 
+// whether two cameras are in exactly the same place
+inline bool operator==(const Camera3D& a, const Camera3D& b)
+{
+    return a.pos == b.pos && a.pitch == b.pitch && a.yaw == b.yaw;
+}
+
+
 // contains the information necessary to transform vertices from view space to screen space
 struct Screen
 {
@@ -220,55 +362,299 @@ struct Screen
 };
 
 
-// a rendering target with a frame buffer
+// whether two screens project vertices exactly the same way
+inline bool operator==(const Screen& a, const Screen& b)
+{
+    return a.width == b.width && a.height == b.height && a.fov == b.fov;
+}
+
+
+// how many neighboring pixels share a single shaded color (depth is always computed for every pixel)
+enum class ShadingRate
+{
+    Full,
+    Coarse2x2,
+    Coarse4x4,
+    
+    // picks one of the other rates for each triangle, based on how many texels each of its pixels covers
+    Auto,
+};
+
+
+// how pixels divide interpolated values by w to undo perspective
+enum class PerspectiveDivide3D
+{
+    // divides every value, which is exact but costs several divisions per pixel
+    Exact,
+    
+    // multiplies every value by a single reciprocal from FastReciprocal, which is off by a couple of units in the last
+    // place, and can move some pixels by a shade or a texel
+    Fast,
+};
+
+
+// returns by how many bits pixel coordinates are shifted to find their shading block (0 for full rate shading)
+inline int GetShadingShift(ShadingRate rate)
+{
+    switch (rate)
+    {
+        case ShadingRate::Coarse2x2:
+            return 1;
+        
+        case ShadingRate::Coarse4x4:
+            return 2;
+        
+        default:
+            return 0;
+    }
+}
+
+
+// which pixels of a target get drawn each frame (anything other than Full draws half of them, alternating every frame)
+enum class RenderPattern
+{
+    Full,
+    Checkerboard,
+    Interlaced,
+};
+
+
+// a rectangle of tiles, including both corners (empty when a corner is past the other)
+struct TileRect3D
+{
+    int x1 = 0;
+    int y1 = 0;
+    int x2 = -1;
+    int y2 = -1;
+    
+    // whether this rectangle covers no tiles at all
+    inline bool IsEmpty() const
+    {
+        return x2 < x1 || y2 < y1;
+    }
+};
+
+
+// a rendering target with a color and depth buffer
 struct Target
 {
-    SDL_Surface* surface;
+    // size of the square tiles a target is split into when only part of it gets redrawn
+    static constexpr int tile_size = 16;
+    
+    Image3D image;
     std::vector<float> depth_buffer;
     
-    // constructs a target from a surface and resizes the depth buffer accordingly
-    inline Target(SDL_Surface* surface):
-        surface(surface)
+    // where draws actually go if the target was created with a tiled layout, in which case image and depth_buffer only
+    // change when Detile is called (anything reading those directly, like resolvers and reprojection, needs that first)
+    TiledSurface3D tiles;
+    
+    // which tiles can currently be drawn to, with one byte per tile (empty means every tile can)
+    std::vector<Uint8> tile_mask;
+    
+    // shading rate of each tile, with one ShadingRate per tile (empty means every tile is shaded at full rate)
+    // (the coarser of a tile's rate and a draw's rate is used)
+    std::vector<ShadingRate> tile_rates;
+    
+    // which pixels get drawn this frame, and which half of them when only half are drawn (0 or 1)
+    RenderPattern pattern = RenderPattern::Full;
+    Uint32 pattern_phase = 0;
+    
+    // constructs a target that draws into the given image and resizes the depth buffer accordingly
+    // (tiled targets start out with the image's pixels, and can ask for huge pages, see TiledSurface3D)
+    inline Target(const Image3D& image, TargetLayout3D layout = TargetLayout3D::Linear, bool huge_pages = false):
+        image(image)
     {
-        depth_buffer.resize(surface->w * surface->h);
+        static_assert(tile_size == TiledSurface3D::tile_size, "tiled surfaces must use the same tiles as targets");
+        
+        depth_buffer.resize(image.width * image.height);
         std::fill(depth_buffer.begin(), depth_buffer.end(), 1.0f);
+        
+        if (layout == TargetLayout3D::Tiled)
+        {
+            tiles = TiledSurface3D(image.width, image.height, huge_pages);
+            tiles.Tile(image);
+        }
+    }
+    
+    // whether draws go to tiles rather than straight into the image
+    bool IsTiled() const
+    {
+        return !tiles.IsEmpty();
+    }
+    
+    // copies what was drawn to the tiles into the image, and into the depth buffer as well if asked to, which has to
+    // happen before presenting or saving the image of a tiled target (does nothing for linear ones)
+    void Detile(bool with_depth = false)
+    {
+        if (IsTiled())
+        { tiles.Detile(image, with_depth ? &depth_buffer : nullptr); }
     }
     
     // blits a single pixel onto the render target if the given depth permits it
-    void Blit(int x, int y, float depth, const SDL_Color& color)
+    void Blit(int x, int y, float depth, const Color3D& color)
+    {
+        if (x >= 0 && x < image.width && y >= 0 && y < image.height && TestDepth(x, y, depth))
+        { BlitPixel(x, y, depth, image.Map(color)); }
+    }
+    
+    // blits a single pixel value already in the image's format onto the render target (the pixel must exist and pass the depth test)
+    void BlitPixel(int x, int y, float depth, Uint32 pixel)
+    {
+        if (IsTiled())
+        {
+            tiles.Pixel(x, y) = pixel;
+            tiles.Depth(x, y) = depth;
+            return;
+        }
+        
+        depth_buffer[y * image.width + x] = depth;
+        image.WritePixel(x, y, pixel);
+    }
+    
+    // whether the given pixel exists, lies within a tile that can currently be drawn to, and is part of this frame's pattern
+    bool IsWritable(int x, int y) const
     {
-        if (x >= 0 && x < surface->w && y >= 0 && y < surface->h)
+        if (x < 0 || x >= image.width || y < 0 || y >= image.height)
+        { return false; }
+        
+        if (!IsInPattern(x, y))
+        { return false; }
+        
+        return tile_mask.empty() || tile_mask[(y / tile_size) * GetTileColumns() + x / tile_size] != 0;
+    }
+    
+    // whether any of the given tiles can currently be drawn to (tiles outside of the target are ignored)
+    bool IsAnyTileWritable(const TileRect3D& tiles) const
+    {
+        auto x1 = std::max(tiles.x1, 0);
+        auto y1 = std::max(tiles.y1, 0);
+        auto x2 = std::min(tiles.x2, GetTileColumns() - 1);
+        auto y2 = std::min(tiles.y2, GetTileRows() - 1);
+        
+        if (tile_mask.empty())
+        { return x1 <= x2 && y1 <= y2; }
+        
+        for (int ty = y1; ty <= y2; ++ty)
         {
-            auto depth_i = y * surface->w + x;
-            if (depth < depth_buffer[depth_i])
+            for (int tx = x1; tx <= x2; ++tx)
             {
-                depth_buffer[depth_i] = depth;
-                SDL_Blit(surface, x, y, color);
+                if (tile_mask[ty * GetTileColumns() + tx] != 0)
+                { return true; }
             }
         }
+        
+        return false;
+    }
+    
+    // whether the given pixel gets drawn this frame according to the target's pattern
+    bool IsInPattern(int x, int y) const
+    {
+        switch (pattern)
+        {
+            case RenderPattern::Checkerboard:
+                return ((x + y + pattern_phase) & 1) == 0;
+            
+            case RenderPattern::Interlaced:
+                return ((y + pattern_phase) & 1) == 0;
+            
+            default:
+                return true;
+        }
+    }
+    
+    // whether a pixel at the given depth would currently pass the depth test (the pixel must exist)
+    bool TestDepth(int x, int y, float depth) const
+    {
+        return depth < (IsTiled() ? tiles.Depth(x, y) : depth_buffer[y * image.width + x]);
+    }
+    
+    // returns the shading rate of the tile the given pixel lies in (the pixel must exist)
+    ShadingRate GetTileShadingRate(int x, int y) const
+    {
+        return tile_rates.empty() ? ShadingRate::Full : tile_rates[(y / tile_size) * GetTileColumns() + x / tile_size];
     }
     
-    // reads a single pixel color from the surface
-    SDL_Color Read(int x, int y) const
+    // sets the shading rate of a single tile
+    void SetTileShadingRate(int tile_x, int tile_y, ShadingRate rate)
     {
-        return SDL_ReadPixel(surface, x, y);
+        tile_rates.resize(GetTileColumns() * GetTileRows(), ShadingRate::Full);
+        tile_rates[tile_y * GetTileColumns() + tile_x] = rate;
+    }
+    
+    // number of tiles needed to cover the width of the image
+    int GetTileColumns() const
+    {
+        return (image.width + tile_size - 1) / tile_size;
+    }
+    
+    // number of tiles needed to cover the height of the image
+    int GetTileRows() const
+    {
+        return (image.height + tile_size - 1) / tile_size;
+    }
+    
+    // clears both the color and depth of a single tile
+    void ClearTile(int tile_x, int tile_y, const Color3D& color)
+    {
+        if (IsTiled())
+        {
+            tiles.FillTile(tile_x, tile_y, image.Map(color), 1.0f);
+            return;
+        }
+        
+        auto x1 = tile_x * tile_size;
+        auto y1 = tile_y * tile_size;
+        auto x2 = std::min(x1 + tile_size, image.width);
+        auto y2 = std::min(y1 + tile_size, image.height);
+        
+        image.Fill(x1, y1, x2 - x1, y2 - y1, image.Map(color));
+        
+        for (int y = y1; y < y2; ++y)
+        {
+            GetSimdKernels().fill_depth(&depth_buffer[y * image.width + x1], x2 - x1, 1.0f);
+        }
+    }
+    
+    // reads a single pixel color from the image
+    Color3D Read(int x, int y) const
+    {
+        return IsTiled() ? image.Unmap(tiles.Pixel(x, y)) : image.Read(x, y);
     }
     
     // clears the depth buffer by filling it with ones
     void ClearDepth()
     {
-        std::fill(depth_buffer.begin(), depth_buffer.end(), 1.0f);
+        if (IsTiled())
+        { tiles.FillDepths(1.0f); }
+        else
+        { GetSimdKernels().fill_depth(depth_buffer.data(), depth_buffer.size(), 1.0f); }
     }
     
-    // clears the surface with the given SDL_Color value
-    void ClearSurface(const SDL_Color& color)
+    // clears the image with the given color
+    void ClearSurface(const Color3D& color)
     {
-        Uint32 pixel = SDL_MapRGBA(surface->format, color.r, color.g, color.b, color.a);
-        SDL_FillRect(surface, nullptr, pixel);
+        if (IsTiled())
+        { tiles.FillPixels(image.Map(color)); }
+        else
+        { image.Fill(image.Map(color)); }
     }
 };
 
 
+// finds the tiles of a target that pixels within the given screen space bounds could be drawn to (tiles outside of the
+// target are included, since callers know what they're clipping against)
+// (pixels get rounded while rasterizing, so bounds are grown by a pixel to be safe)
+inline TileRect3D GetTileRect(const glm::vec2& min, const glm::vec2& max)
+{
+    return TileRect3D{
+        (int)std::floor((min.x - 1.0f) / Target::tile_size),
+        (int)std::floor((min.y - 1.0f) / Target::tile_size),
+        (int)std::floor((max.x + 1.0f) / Target::tile_size),
+        (int)std::floor((max.y + 1.0f) / Target::tile_size),
+    };
+}
+
+
 // linearly interpolates two Vertex3D values
 inline Vertex3D Lerp(const Vertex3D& a, const Vertex3D& b, float p)
 {
@@ -290,6 +676,15 @@ inline glm::vec3 TranslateToView(const glm::vec3& pos, const Camera3D& camera)
 }
 
 
+// translates the given point from view space back to world space (undoes TranslateToView)
+inline glm::vec3 TranslateToWorld(const glm::vec3& pos, const Camera3D& camera)
+{
+    auto pitch = glm::radians(camera.pitch);
+    auto yaw = glm::radians(camera.yaw);
+    return glm::rotateY(glm::rotateX(pos, -yaw), -pitch) + camera.pos;
+}
+
+
 // scales a 3D point from view space to screen space
 inline glm::vec3 ScaleToScreen(const glm::vec3& pos, const Screen& screen)
 {
@@ -305,6 +700,21 @@ inline glm::vec3 ScaleToScreen(const glm::vec3& pos, const Screen& screen)
 }
 
 
+// scales a screen space point with the given view space depth back to view space (undoes ScaleToScreen)
+inline glm::vec3 UnscaleFromScreen(const glm::vec3& pos, const Screen& screen)
+{
+    auto diff = screen.width - screen.height;
+    auto fov_factor = screen.fov / 90.0f;
+    
+    return glm::vec3
+    {
+        Remap(pos.x, diff / 2.0f, screen.height + diff / 2.0f, -1.0, 1.0) * pos.z * fov_factor,
+        Remap(pos.y, screen.height, 0.0f, -1.0, 1.0) * pos.z * fov_factor,
+        pos.z
+    };
+}
+
+
 // scales a 3D triangle from view space to screen space
 inline Triangle3D ScaleToScreen(const Triangle3D& triangle, const Screen& screen)
 {
@@ -319,19 +729,142 @@ inline Triangle3D ScaleToScreen(const Triangle3D& triangle, const Screen& screen
 }
 
 
+// everything a draw needs to know besides what to draw and where, which is handed to every draw rather than kept in the
+// renderer, so that several threads can draw into separate targets (or separate tiles of one) at the same time
+struct PipelineState3D
+{
+    // image textures get sampled from, if any
+    const Image3D* sampler = nullptr;
+    
+    // virtual texture textures get sampled from instead, if any (set this directly, since it has no constructor of its own)
+    const VirtualTexture3D* virtual_texture = nullptr;
+    
+    // how many pixels share a single shaded color
+    ShadingRate shading_rate = ShadingRate::Full;
+    
+    // whether vertex colors and texels get multiplied in linear light rather than sRGB (palettized targets always
+    // multiply palette indices through their palette's table instead)
+    bool linear_light = false;
+    
+    // constructs the state of an untextured draw shaded at full rate
+    inline PipelineState3D() = default;
+    
+    // constructs the state of a draw sampling from the given image, if any (empty images count as none)
+    inline PipelineState3D(const Image3D* sampler, ShadingRate shading_rate = ShadingRate::Full, bool linear_light = false):
+        sampler(sampler != nullptr && !sampler->IsEmpty() ? sampler : nullptr),
+        shading_rate(shading_rate),
+        linear_light(linear_light)
+    {}
+};
+
+
+// pixels shaded for coarse blocks of pixels, one list per coarse shading rate with one pixel per block column
+// (each pixel is tagged with the triangle and block row it belongs to, so it never has to be cleared)
+struct CoarseShadingCache3D
+{
+    std::array<std::vector<Uint32>, 2> pixels;
+    std::array<std::vector<Uint64>, 2> tags;
+    Uint64 serial = 0;
+};
+
+
+// returns the calling thread's coarse shading cache (every thread gets its own, so drawing never shares any scratch memory)
+inline CoarseShadingCache3D& GetCoarseShadingCache()
+{
+    thread_local CoarseShadingCache3D cache;
+    return cache;
+}
+
+
 // software renderer for 3D polygons
+// (every draw can be given its own PipelineState3D, and only draws that aren't read the renderer's state, which is set
+// through SetSampler and SetShadingRate, so draws given one can safely happen on several threads at once)
 struct Renderer3D
 {
-    SDL_Surface* sampler = nullptr;
+    PipelineState3D state;
     
-    // changes which SDL_Surface the renderer samples textures from, if any
-    inline void SetSampler(SDL_Surface* sampler)
+    // how every draw divides by w, which is picked once for the whole renderer since it trades precision for speed
+    PerspectiveDivide3D divide = PerspectiveDivide3D::Exact;
+    
+    // changes which image draws without a pipeline state sample textures from, if any (empty images count as none)
+    inline void SetSampler(const Image3D* sampler)
     {
-        this->sampler = sampler;
+        state = PipelineState3D(sampler, state.shading_rate, state.linear_light);
     }
     
-    // blits a single screen space triangle to the given target
-    inline void BlitTriangle(Target& target, const glm::vec2& clip, const Triangle3D& triangle)
+    // changes which virtual texture draws without a pipeline state sample textures from instead of an image, if any
+    inline void SetVirtualTexture(const VirtualTexture3D* virtual_texture)
+    {
+        state = PipelineState3D(nullptr, state.shading_rate, state.linear_light);
+        state.virtual_texture = virtual_texture != nullptr && virtual_texture->IsOpen() ? virtual_texture : nullptr;
+    }
+    
+    // changes how many pixels share a single shaded color in draws without a pipeline state
+    inline void SetShadingRate(ShadingRate rate)
+    {
+        state.shading_rate = rate;
+    }
+    
+    // changes whether draws without a pipeline state multiply colors in linear light
+    inline void SetLinearLight(bool linear_light)
+    {
+        state.linear_light = linear_light;
+    }
+    
+    // changes how every draw divides by w (must not be changed while anything is drawing)
+    inline void SetPerspectiveDivide(PerspectiveDivide3D mode)
+    {
+        divide = mode;
+    }
+    
+    // returns how many pixels a screen space triangle covers (x), and how many texels of a texture of the given size (y)
+    inline glm::vec2 GetTriangleAreas(const Triangle3D& triangle, const glm::vec2& texture_size) const
+    {
+        auto& verts = triangle.vertices;
+        
+        auto pixel_span1 = glm::vec2(verts[1].pos - verts[0].pos);
+        auto pixel_span2 = glm::vec2(verts[2].pos - verts[0].pos);
+        auto texel_span1 = (verts[1].uv - verts[0].uv) * texture_size;
+        auto texel_span2 = (verts[2].uv - verts[0].uv) * texture_size;
+        
+        return glm::vec2(
+            std::abs(pixel_span1.x * pixel_span2.y - pixel_span1.y * pixel_span2.x),
+            std::abs(texel_span1.x * texel_span2.y - texel_span1.y * texel_span2.x)
+        );
+    }
+    
+    // picks a shading rate for a screen space triangle based on how many texels of the given image each of its pixels covers
+    inline ShadingRate ChooseShadingRate(const Triangle3D& triangle, const Image3D* sampler) const
+    {
+        // untextured triangles only have smoothly interpolated vertex colors
+        if (sampler == nullptr)
+        { return ShadingRate::Coarse2x2; }
+        
+        return ChooseShadingRate(triangle, glm::vec2(sampler->width, sampler->height));
+    }
+    
+    // picks a shading rate for a screen space triangle based on how many texels of a texture of the given size each of
+    // its pixels covers
+    inline ShadingRate ChooseShadingRate(const Triangle3D& triangle, const glm::vec2& texture_size) const
+    {
+        auto areas = GetTriangleAreas(triangle, texture_size);
+        auto pixel_area = areas.x;
+        auto texel_area = areas.y;
+        
+        // heavily magnified textures look about the same whether they're sampled once per pixel or once per block
+        // (only texel edges get slightly blockier, so texels need to be twice as big as a block to switch)
+        if (texel_area * 64.0f <= pixel_area)
+        { return ShadingRate::Coarse4x4; }
+        else if (texel_area * 16.0f <= pixel_area)
+        { return ShadingRate::Coarse2x2; }
+        else
+        { return ShadingRate::Full; }
+    }
+    
+    // splits a screen space triangle into triangles with a flat top or bottom (the only kind BlitFlatTriangle can draw)
+    // and hands each of them to the given function, skipping triangles that can't be drawn or lie entirely off screen
+    template<typename F>
+    inline void SetupTriangle(const glm::vec2& clip, const Triangle3D& triangle, F&& emit) const
     {
         auto& verts = triangle.vertices;
         
@@ -376,110 +909,413 @@ struct Renderer3D
             // draw top and bottom triangles (and do a bit of work to preserve winding order)
             if (auto order = Triangle3D{ *vert1, *vert2, *vert3 }.GetWindingOrder(); order == 1)
             {
-                BlitTriangle(target, clip, { *vert1, *vert2, vert4 });
-                BlitTriangle(target, clip, { *vert2, *vert3, vert4 });
+                SetupTriangle(clip, { *vert1, *vert2, vert4 }, emit);
+                SetupTriangle(clip, { *vert2, *vert3, vert4 }, emit);
             }
             else if (order == -1)
             {
-                BlitTriangle(target, clip, { *vert2, *vert1, vert4 });
-                BlitTriangle(target, clip, { *vert3, *vert2, vert4 });
+                SetupTriangle(clip, { *vert2, *vert1, vert4 }, emit);
+                SetupTriangle(clip, { *vert3, *vert2, vert4 }, emit);
             }
         }
-        // this is where drawing triangles actually happens! finally!
+        // triangles that are ready to be drawn, unless none of their pixels are on screen
         else if (verts[0].pos.y != verts[1].pos.y && verts[1].pos.y == verts[2].pos.y)
         {
-            // find height
-            auto y1 = verts[0].pos.y;
-            auto y2 = verts[1].pos.y;
-            auto height = std::abs(std::round(y2) - std::round(y1));
-            
-            // get top vertex (slight misnomer; can also be single bottom vertex)
-            const Vertex3D* t_vert = &verts[0];
+            auto min = glm::min(glm::min(glm::vec2(verts[0].pos), glm::vec2(verts[1].pos)), glm::vec2(verts[2].pos));
+            auto max = glm::max(glm::max(glm::vec2(verts[0].pos), glm::vec2(verts[1].pos)), glm::vec2(verts[2].pos));
             
-            // find leftmost and rightmost vertices
-            const Vertex3D* l_vert;
-            const Vertex3D* r_vert;
+            if (max.x < 0.0f || max.y < 0.0f || min.x > clip.x || min.y > clip.y)
+            { return; }
             
-            if (verts[1].pos.x < verts[2].pos.x)
+            emit(triangle);
+        }
+        else
+        {
+            // in these two cases, we rotate the triangle so the first vertex is the one pointing away from the flat top/bottom
+            if (verts[0].pos.y == verts[1].pos.y)
             {
-                l_vert = &verts[1];
-                r_vert = &verts[2];
+                SetupTriangle(clip, { verts[2], verts[0], verts[1] }, emit);
             }
-            else
+            else // if (verts[0].pos.y == verts[2].pos.y)
             {
-                l_vert = &verts[2];
-                r_vert = &verts[1];
+                SetupTriangle(clip, { verts[1], verts[2], verts[0] }, emit);
             }
+        }
+    }
+    
+    // blits the pixels of a single row of a flat triangle from x_start to x_end, a tile's worth of pixels at a time,
+    // working out depths, texels and colors for each span with the vector kernels (spans in tiles shaded coarsely are
+    // handed to blit_pixel one pixel at a time instead)
+    // (left and right are the interpolation-ready vertices at the row's edges x1 and x2, which must differ)
+    template<typename PixelFunction>
+    inline void BlitSpans(Target& target, const PipelineState3D& state, const Vertex3D& left, const Vertex3D& right,
+        float x1, float x2, float x_start, float x_end, int yy, PixelFunction& blit_pixel) const
+    {
+        constexpr int span_size = Target::tile_size;
+        
+        auto& kernels = GetSimdKernels();
+        auto& image = target.image;
+        auto& sampler = state.sampler;
+        auto tiled = target.IsTiled();
+        
+        // every value changes linearly across the row
+        auto steps = 1.0f / (x2 - x1);
+        auto pos_step = (right.pos - left.pos) * steps;
+        auto color_step = (right.color - left.color) * steps;
+        auto uv_step = (right.uv - left.uv) * steps;
+        
+        auto x_first = (int)x_start;
+        auto count = std::min((int)std::floor(x_end - x_start) + 1, image.width - x_first);
+        
+        alignas(16) float depths[span_size];
+        alignas(16) float ws[span_size];
+        alignas(16) float inv_ws[span_size];
+        alignas(16) float us[span_size];
+        alignas(16) float vs[span_size];
+        alignas(16) Uint32 colors[span_size];
+        alignas(16) Uint32 texels[span_size];
+        Uint8 pass[span_size];
+        
+        // spans never cross the edge of a tile, so each one shares a tile's mask, shading rate and memory
+        for (int begin = 0, n = 0; begin < count; begin += n)
+        {
+            auto x = x_first + begin;
+            auto offset = x_start + (float)begin - x1;
+            n = std::min(count - begin, span_size - (x & (span_size - 1)));
             
-            // get interpolation-ready vertices
-            auto t_vert_i = t_vert->Interp();
-            auto l_vert_i = l_vert->Interp();
-            auto r_vert_i = r_vert->Interp();
+            if (!target.tile_mask.empty() && target.tile_mask[(yy / span_size) * target.GetTileColumns() + x / span_size] == 0)
+            { continue; }
             
-            // determine vertical clipping
-            float t_clip;
-            float b_clip;
+            if (GetShadingShift(target.GetTileShadingRate(x, yy)) > 0)
+            {
+                for (int i = 0; i < n; ++i)
+                {
+                    blit_pixel(x_start + (float)(begin + i));
+                }
+                
+                continue;
+            }
+            
+            // find where the span's pixels and depths are, and which of them are nearer than what's already there
+            auto tile_offset = TiledSurface3D::GetTileOffset(x, yy);
+            auto pixels = tiled ? target.tiles.GetTilePixels(x / span_size, yy / span_size) + tile_offset :
+                image.format == PixelFormat3D::ARGB8888 ? image.GetPixelRow(yy) + x : nullptr;
+            auto depth_buffer = tiled ? target.tiles.GetTileDepths(x / span_size, yy / span_size) + tile_offset :
+                target.depth_buffer.data() + (size_t)yy * image.width + x;
             
-            if (y1 < y2)
+            kernels.depth_span(depths, pass, depth_buffer, n, left.pos.z + offset * pos_step.z, pos_step.z,
+                left.pos.w + offset * pos_step.w, pos_step.w);
+            
+            auto any = false;
+            
+            for (int i = 0; i < n; ++i)
             {
-                t_clip = std::round(Remap(0.0f,   y1, y2, 0.0f, height)) + 0.5f;
-                b_clip = std::round(Remap(clip.y, y1, y2, 0.0f, height)) - 0.5f;
+                pass[i] = pass[i] && target.IsInPattern(x + i, yy);
+                any = any || pass[i];
             }
+            
+            // skip spans that are entirely hidden before shading them
+            if (!any)
+            { continue; }
+            
+            // undo perspective
+            for (int i = 0; i < n; ++i)
+            { ws[i] = left.pos.w + (offset + (float)i) * pos_step.w; }
+            
+            if (divide == PerspectiveDivide3D::Fast)
+            { kernels.reciprocal(inv_ws, ws, n); }
             else
             {
-                t_clip = std::round(Remap(clip.y, y1, y2, 0.0f, height)) + 0.5f;
-                b_clip = std::round(Remap(0.0f,   y1, y2, 0.0f, height)) - 0.5f;
+                for (int i = 0; i < n; ++i)
+                { inv_ws[i] = 1.0f / ws[i]; }
+            }
+            
+            // determine colors, and blend samples into them
+            for (int i = 0; i < n; ++i)
+            {
+                colors[i] = PackARGB8888(ToColor((left.color + (offset + (float)i) * color_step) * inv_ws[i]));
             }
             
-            // draw pixels
-            for (float y = std::max(0.5f, t_clip); y <= std::min(height, b_clip); y += 1.0f)
+            if (sampler != nullptr)
             {
-                // find edges of current row
-                auto x1 = std::round(Remap(y, 0.0f, height, t_vert->pos.x, l_vert->pos.x));
-                auto x2 = std::round(Remap(y, 0.0f, height, t_vert->pos.x, r_vert->pos.x));
+                for (int i = 0; i < n; ++i)
+                {
+                    us[i] = (left.uv.x + (offset + (float)i) * uv_step.x) * inv_ws[i];
+                    vs[i] = (left.uv.y + (offset + (float)i) * uv_step.y) * inv_ws[i];
+                }
                 
-                // draw current row
-                for (float x = std::max(x1, 0.5f); x <= std::min(x2, clip.x - 0.5f); x += 1.0f)
+                // only 32 bit textures can be read directly, anything else gets converted one texel at a time
+                if (sampler->format == PixelFormat3D::ARGB8888)
                 {
-                    // find progress across x and y axes
-                    auto xp = InvLerp(x, x1, x2);
-                    auto yp = InvLerp(y, 0.0, height);
-                    
-                    // interpolate vertices in 2D
-                    auto vertex = Lerp(t_vert_i, Lerp(l_vert_i, r_vert_i, xp), yp).Restore();
-                    
-                    // determine color
-                    SDL_Color color = ToColor(vertex.color);
-                    
-                    // blend sample color
-                    if (sampler != nullptr)
-                    { color = Blend(color, SDL_Sample(sampler, vertex.uv.x, vertex.uv.y)); }
-                    
-                    // determine position at which to draw our pixel
-                    auto yy = (int)(Lerp(y1, y2, yp));
-                    auto xx = (int)(x);
-                    
-                    // blit the pixel
-                    target.Blit(xx, yy, vertex.pos.z / 10000.0f, color);
+                    kernels.sample_nearest(texels, (const Uint32*)sampler->pixels, sampler->width, sampler->height,
+                        sampler->pitch / (int)sizeof(Uint32), us, vs, n);
+                }
+                else
+                {
+                    for (int i = 0; i < n; ++i)
+                    { texels[i] = PackARGB8888(Sample(*sampler, us[i], vs[i])); }
                 }
+                
+                if (state.linear_light)
+                { kernels.modulate_pixels_linear(colors, colors, texels, n); }
+                else
+                { kernels.modulate_pixels(colors, colors, texels, n); }
+            }
+            
+            // blit the pixels that passed (16 bit targets get dithered as they're written, so that gradients don't band)
+            for (int i = 0; i < n; ++i)
+            {
+                if (!pass[i])
+                { continue; }
+                
+                auto pixel = image.format == PixelFormat3D::RGB565 ?
+                    (Uint32)PackRGB565Dithered(UnpackARGB8888(colors[i]), x + i, yy) :
+                    colors[i];
+                
+                if (pixels != nullptr)
+                { pixels[i] = pixel; }
+                else
+                { image.WritePixel(x + i, yy, pixel); }
+                
+                depth_buffer[i] = depths[i];
             }
         }
+    }
+    
+    // blits a screen space triangle with a flat top or bottom whose first vertex is the one across from it, which is
+    // where drawing triangles actually happens! finally!
+    inline void BlitFlatTriangle(Target& target, const PipelineState3D& state, const glm::vec2& clip, const Triangle3D& triangle) const
+    {
+        auto& verts = triangle.vertices;
+        
+        // find height
+        auto y1 = verts[0].pos.y;
+        auto y2 = verts[1].pos.y;
+        auto height = std::abs(std::round(y2) - std::round(y1));
+        
+        // get top vertex (slight misnomer; can also be single bottom vertex)
+        const Vertex3D* t_vert = &verts[0];
+        
+        // find leftmost and rightmost vertices
+        const Vertex3D* l_vert;
+        const Vertex3D* r_vert;
+        
+        if (verts[1].pos.x < verts[2].pos.x)
+        {
+            l_vert = &verts[1];
+            r_vert = &verts[2];
+        }
         else
         {
-            // in these two cases, we rotate the triangle so the first vertex is the one pointing away from the flat top/bottom
-            if (verts[0].pos.y == verts[1].pos.y)
+            l_vert = &verts[2];
+            r_vert = &verts[1];
+        }
+        
+        // get interpolation-ready vertices
+        auto t_vert_i = t_vert->Interp();
+        auto l_vert_i = l_vert->Interp();
+        auto r_vert_i = r_vert->Interp();
+        
+        // find how coarsely this triangle can be shaded, and make room to remember coarse colors
+        auto& sampler = state.sampler;
+        auto& virtual_texture = state.virtual_texture;
+        auto& rate = state.shading_rate;
+        auto triangle_rate = rate;
+        int mip = 0;
+        
+        if (virtual_texture != nullptr && sampler == nullptr)
+        {
+            // virtual textures are sampled from a single mip level per triangle
+            auto texture_size = glm::vec2(virtual_texture->width, virtual_texture->height);
+            auto areas = GetTriangleAreas(triangle, texture_size);
+            mip = virtual_texture->ChooseMip(areas.x, areas.y);
+            
+            if (rate == ShadingRate::Auto)
+            { triangle_rate = ChooseShadingRate(triangle, texture_size / (float)(1 << mip)); }
+        }
+        else if (rate == ShadingRate::Auto)
+        { triangle_rate = ChooseShadingRate(triangle, sampler); }
+        
+        auto triangle_shift = GetShadingShift(triangle_rate);
+        
+        auto& coarse = GetCoarseShadingCache();
+        coarse.serial += 1;
+        
+        for (size_t level = 0; level < coarse.tags.size(); ++level)
+        {
+            if (coarse.tags[level].size() < (size_t)target.image.width)
             {
-                BlitTriangle(target, clip, { verts[2], verts[0], verts[1] });
+                coarse.pixels[level].resize(target.image.width);
+                coarse.tags[level].resize(target.image.width, 0);
             }
-            else // if (verts[0].pos.y == verts[2].pos.y)
+        }
+        
+        // determine vertical clipping
+        float t_clip;
+        float b_clip;
+        
+        if (y1 < y2)
+        {
+            t_clip = std::round(Remap(0.0f,   y1, y2, 0.0f, height)) + 0.5f;
+            b_clip = std::round(Remap(clip.y, y1, y2, 0.0f, height)) - 0.5f;
+        }
+        else
+        {
+            t_clip = std::round(Remap(clip.y, y1, y2, 0.0f, height)) + 0.5f;
+            b_clip = std::round(Remap(0.0f,   y1, y2, 0.0f, height)) - 0.5f;
+        }
+        
+        // spans of pixels get depth tested, sampled and modulated by the vector kernels, which needs 32 or 16 bit targets
+        // and pixels that are each shaded on their own from an image texture, or not textured at all (palettized
+        // targets, coarse shading and virtual textures shade one pixel at a time instead)
+        auto format = target.image.format;
+        auto use_spans = (format == PixelFormat3D::ARGB8888 || format == PixelFormat3D::RGB565) &&
+            triangle_shift == 0 && (sampler != nullptr || virtual_texture == nullptr);
+        auto fast_divide = divide == PerspectiveDivide3D::Fast;
+        
+        // draw pixels
+        for (float y = std::max(0.5f, t_clip); y <= std::min(height, b_clip); y += 1.0f)
+        {
+            // find edges of current row
+            auto x1 = std::round(Remap(y, 0.0f, height, t_vert->pos.x, l_vert->pos.x));
+            auto x2 = std::round(Remap(y, 0.0f, height, t_vert->pos.x, r_vert->pos.x));
+            
+            // find progress across the y axis, and the row to draw to
+            auto yp = InvLerp(y, 0.0, height);
+            auto yy = (int)(Lerp(y1, y2, yp));
+            
+            // shades and blits a single pixel of the current row
+            auto blit_pixel = [&](float x)
+            {
+                // find progress across the x axis
+                auto xp = InvLerp(x, x1, x2);
+                
+                // determine position at which to draw our pixel
+                auto xx = (int)(x);
+                
+                // skip pixels in tiles that aren't being redrawn before doing any work for them
+                if (!target.IsWritable(xx, yy))
+                { return; }
+                
+                // interpolate depth on its own, since hidden pixels and pixels reusing a coarse color don't need anything else
+                auto depth_w = Lerp(t_vert_i.pos.z, Lerp(l_vert_i.pos.z, r_vert_i.pos.z, xp), yp);
+                auto w = Lerp(t_vert_i.pos.w, Lerp(l_vert_i.pos.w, r_vert_i.pos.w, xp), yp);
+                
+                // the fast divide works out one reciprocal of w and shares it with the vertex below
+                auto inv_w = fast_divide ? FastReciprocal(w) : 0.0f;
+                auto depth = fast_divide ? depth_w * inv_w * 0.0001f : depth_w / w / 10000.0f;
+                
+                // skip hidden pixels before shading them
+                if (!target.TestDepth(xx, yy, depth))
+                { return; }
+                
+                // pixels in a coarse block reuse the color of the first pixel shaded in that block
+                auto shift = std::max(triangle_shift, GetShadingShift(target.GetTileShadingRate(xx, yy)));
+                auto tag = (coarse.serial << 24) | (Uint64)(yy >> shift);
+                
+                Uint32 pixel;
+                
+                if (shift > 0 && coarse.tags[shift - 1][xx >> shift] == tag)
+                {
+                    pixel = coarse.pixels[shift - 1][xx >> shift];
+                }
+                else
+                {
+                    // interpolate vertices in 2D
+                    auto interpolated = Lerp(t_vert_i, Lerp(l_vert_i, r_vert_i, xp), yp);
+                    auto vertex = fast_divide ? interpolated.Restore(inv_w) : interpolated.Restore();
+                    
+                    // determine color
+                    auto color = ToColor(vertex.color);
+                    
+                    if (target.image.format == PixelFormat3D::Index8 && target.image.palette != nullptr)
+                    {
+                        // palettized targets stay in palette indices, and modulate them through a lookup table
+                        auto& palette = *target.image.palette;
+                        auto index = palette.MatchDithered(color, xx, yy);
+                        
+                        if (sampler != nullptr)
+                        {
+                            auto texel = sampler->palette == &palette ?
+                                SampleIndex(*sampler, vertex.uv.x, vertex.uv.y) :
+                                palette.MatchDithered(Sample(*sampler, vertex.uv.x, vertex.uv.y), xx, yy);
+                            
+                            index = palette.Modulate(index, texel);
+                        }
+                        else if (virtual_texture != nullptr)
+                        {
+                            auto texel = palette.MatchDithered(virtual_texture->Sample(vertex.uv.x, vertex.uv.y, mip, xx, yy), xx, yy);
+                            index = palette.Modulate(index, texel);
+                        }
+                        
+                        pixel = index;
+                    }
+                    else
+                    {
+                        // blend sample color
+                        if (sampler != nullptr || virtual_texture != nullptr)
+                        {
+                            auto texel = sampler != nullptr ?
+                                Sample(*sampler, vertex.uv.x, vertex.uv.y) :
+                                virtual_texture->Sample(vertex.uv.x, vertex.uv.y, mip, xx, yy);
+                            
+                            color = state.linear_light ? BlendLinear(color, texel) : Blend(color, texel);
+                        }
+                        
+                        // 16 bit targets get dithered as they're written, so that gradients don't band
+                        if (target.image.format == PixelFormat3D::RGB565)
+                        { pixel = PackRGB565Dithered(color, xx, yy); }
+                        else
+                        { pixel = target.image.Map(color); }
+                    }
+                    
+                    if (shift > 0)
+                    {
+                        coarse.pixels[shift - 1][xx >> shift] = pixel;
+                        coarse.tags[shift - 1][xx >> shift] = tag;
+                    }
+                }
+                
+                // blit the pixel
+                target.BlitPixel(xx, yy, depth, pixel);
+            };
+            
+            auto x_start = std::max(x1, 0.5f);
+            auto x_end = std::min(x2, clip.x - 0.5f);
+            
+            // draw current row, one pixel at a time
+            if (!use_spans)
             {
-                BlitTriangle(target, clip, { verts[1], verts[2], verts[0] });
+                for (float x = x_start; x <= x_end; x += 1.0f)
+                {
+                    blit_pixel(x);
+                }
+                
+                continue;
             }
+            
+            // or in spans, which rows one pixel wide and rows outside of the target don't get (they'd never pass the
+            // depth test or the bounds check above anyway)
+            if (x_end < x_start || x2 == x1 || yy < 0 || yy >= target.image.height)
+            { continue; }
+            
+            auto left = Lerp(t_vert_i, l_vert_i, yp);
+            auto right = Lerp(t_vert_i, r_vert_i, yp);
+            
+            BlitSpans(target, state, left, right, x1, x2, x_start, x_end, yy, blit_pixel);
         }
     }
     
-    // clips the given view space triangle to the near plane, scales it to screen space, and blits the result
-    inline void BlitClippedTriangle(Target& target, const Screen& screen, const Triangle3D& triangle)
+    // blits a single screen space triangle to the given target
+    inline void BlitTriangle(Target& target, const PipelineState3D& state, const glm::vec2& clip, const Triangle3D& triangle) const
+    {
+        SetupTriangle(clip, triangle, [&](const Triangle3D& flat) { BlitFlatTriangle(target, state, clip, flat); });
+    }
+    
+    // clips the given view space triangle to the near plane, scales it to screen space, and hands the resulting flat
+    // triangles to the given function
+    template<typename F>
+    inline void SetupClippedTriangle(const Screen& screen, const Triangle3D& triangle, F&& emit) const
     {
         auto& verts = triangle.vertices;
         
@@ -491,7 +1327,7 @@ struct Renderer3D
         bool vert1_clip = verts[1].pos.z < clip_plane;
         bool vert2_clip = verts[2].pos.z < clip_plane;
         
-        // screen space rectangle around which triangles are clipped (this happens inside of BlitTriangle)
+        // screen space rectangle around which triangles are clipped (this happens inside of BlitFlatTriangle)
         auto clip_vec = glm::vec2(screen.width, screen.height);
         
         // if every vertex is behind the clip plane, do nothing
@@ -505,9 +1341,9 @@ struct Renderer3D
             auto to_vert2 = Lerp(verts[0], verts[2], InvLerp(clip_plane, verts[0].pos.z, verts[2].pos.z));
             auto mid_vert = Lerp(verts[1], verts[2], 0.5f);
             
-            BlitTriangle(target, clip_vec, ScaleToScreen(Triangle3D{ to_vert1, verts[1], mid_vert }, screen));
-            BlitTriangle(target, clip_vec, ScaleToScreen(Triangle3D{ to_vert2, to_vert1, mid_vert }, screen));
-            BlitTriangle(target, clip_vec, ScaleToScreen(Triangle3D{ to_vert2, mid_vert, verts[2] }, screen));
+            SetupTriangle(clip_vec, ScaleToScreen(Triangle3D{ to_vert1, verts[1], mid_vert }, screen), emit);
+            SetupTriangle(clip_vec, ScaleToScreen(Triangle3D{ to_vert2, to_vert1, mid_vert }, screen), emit);
+            SetupTriangle(clip_vec, ScaleToScreen(Triangle3D{ to_vert2, mid_vert, verts[2] }, screen), emit);
         }
         else if (!vert0_clip && vert1_clip && !vert2_clip)
         {
@@ -515,9 +1351,9 @@ struct Renderer3D
             auto to_vert2 = Lerp(verts[1], verts[2], InvLerp(clip_plane, verts[1].pos.z, verts[2].pos.z));
             auto mid_vert = Lerp(verts[0], verts[2], 0.5f);
             
-            BlitTriangle(target, clip_vec, ScaleToScreen(Triangle3D{ to_vert0, mid_vert, verts[0] }, screen));
-            BlitTriangle(target, clip_vec, ScaleToScreen(Triangle3D{ to_vert2, mid_vert, to_vert0 }, screen));
-            BlitTriangle(target, clip_vec, ScaleToScreen(Triangle3D{ to_vert2, verts[2], mid_vert }, screen));
+            SetupTriangle(clip_vec, ScaleToScreen(Triangle3D{ to_vert0, mid_vert, verts[0] }, screen), emit);
+            SetupTriangle(clip_vec, ScaleToScreen(Triangle3D{ to_vert2, mid_vert, to_vert0 }, screen), emit);
+            SetupTriangle(clip_vec, ScaleToScreen(Triangle3D{ to_vert2, verts[2], mid_vert }, screen), emit);
         }
         else if (!vert0_clip && !vert1_clip && vert2_clip)
         {
@@ -525,54 +1361,112 @@ struct Renderer3D
             auto to_vert1 = Lerp(verts[2], verts[1], InvLerp(clip_plane, verts[2].pos.z, verts[1].pos.z));
             auto mid_vert = Lerp(verts[0], verts[1], 0.5f);
             
-            BlitTriangle(target, clip_vec, ScaleToScreen(Triangle3D{ to_vert0, verts[0], mid_vert }, screen));
-            BlitTriangle(target, clip_vec, ScaleToScreen(Triangle3D{ to_vert1, to_vert0, mid_vert }, screen));
-            BlitTriangle(target, clip_vec, ScaleToScreen(Triangle3D{ to_vert1, mid_vert, verts[1] }, screen));
+            SetupTriangle(clip_vec, ScaleToScreen(Triangle3D{ to_vert0, verts[0], mid_vert }, screen), emit);
+            SetupTriangle(clip_vec, ScaleToScreen(Triangle3D{ to_vert1, to_vert0, mid_vert }, screen), emit);
+            SetupTriangle(clip_vec, ScaleToScreen(Triangle3D{ to_vert1, mid_vert, verts[1] }, screen), emit);
         }
         // next three cases have two points behind the clip plane and creating a single new triangle (and preserves its winding order)
         else if (!vert0_clip && vert1_clip && vert2_clip)
         {
             auto to_vert1 = Lerp(verts[0], verts[1], InvLerp(clip_plane, verts[0].pos.z, verts[1].pos.z));
             auto to_vert2 = Lerp(verts[0], verts[2], InvLerp(clip_plane, verts[0].pos.z, verts[2].pos.z));
-            BlitTriangle(target, clip_vec, ScaleToScreen(Triangle3D{ verts[0], to_vert1, to_vert2 }, screen));
+            SetupTriangle(clip_vec, ScaleToScreen(Triangle3D{ verts[0], to_vert1, to_vert2 }, screen), emit);
         }
         else if (vert0_clip && !vert1_clip && vert2_clip)
         {
             auto to_vert0 = Lerp(verts[1], verts[0], InvLerp(clip_plane, verts[1].pos.z, verts[0].pos.z));
             auto to_vert2 = Lerp(verts[1], verts[2], InvLerp(clip_plane, verts[1].pos.z, verts[2].pos.z));
-            BlitTriangle(target, clip_vec, ScaleToScreen(Triangle3D{ verts[1], to_vert2, to_vert0 }, screen));
+            SetupTriangle(clip_vec, ScaleToScreen(Triangle3D{ verts[1], to_vert2, to_vert0 }, screen), emit);
         }
         else if (vert0_clip && vert1_clip && !vert2_clip)
         {
             auto to_vert0 = Lerp(verts[2], verts[0], InvLerp(clip_plane, verts[2].pos.z, verts[0].pos.z));
             auto to_vert1 = Lerp(verts[2], verts[1], InvLerp(clip_plane, verts[2].pos.z, verts[1].pos.z));
-            BlitTriangle(target, clip_vec, ScaleToScreen(Triangle3D{ verts[2], to_vert0, to_vert1 }, screen));
+            SetupTriangle(clip_vec, ScaleToScreen(Triangle3D{ verts[2], to_vert0, to_vert1 }, screen), emit);
         }
         // final case simply draws the entire triangle unchanged because it's in front of us (and, obviously, preserves its winding order)
         else
         {
-            BlitTriangle(target, clip_vec, ScaleToScreen(triangle, screen));
+            SetupTriangle(clip_vec, ScaleToScreen(triangle, screen), emit);
         }
     }
     
-    // blits the given world space triangle to the given target
-    inline void BlitWorldTriangle(Target& target, const Camera3D& camera, const Screen& screen, const Triangle3D& triangle, const glm::mat4& transform)
+    // clips the given view space triangle to the near plane, scales it to screen space, and blits the result
+    inline void BlitClippedTriangle(Target& target, const PipelineState3D& state, const Screen& screen, const Triangle3D& triangle) const
+    {
+        auto clip = glm::vec2(screen.width, screen.height);
+        SetupClippedTriangle(screen, triangle, [&](const Triangle3D& flat) { BlitFlatTriangle(target, state, clip, flat); });
+    }
+    
+    // moves the given world space triangle into view space and hands the flat screen space triangles it results in to
+    // the given function
+    template<typename F>
+    inline void SetupWorldTriangle(const Camera3D& camera, const Screen& screen, const Triangle3D& triangle, const glm::mat4& transform, F&& emit) const
     {
         auto& verts = triangle.vertices;
         
-        BlitClippedTriangle(target, screen, Triangle3D {
+        SetupClippedTriangle(screen, Triangle3D {
             Vertex3D{ TranslateToView(transform * verts[0].pos, camera), verts[0].color, verts[0].uv },
             Vertex3D{ TranslateToView(transform * verts[1].pos, camera), verts[1].color, verts[1].uv },
             Vertex3D{ TranslateToView(transform * verts[2].pos, camera), verts[2].color, verts[2].uv },
-        });
+        }, emit);
     }
     
-    // blits the given 3D model's triangles to the given target
-    inline void Blit3DModel(Target& target, const Camera3D& camera, const Screen& screen, const Model3D& model, const glm::mat4& transform = glm::mat4(1.0f))
+    // blits the given world space triangle to the given target
+    inline void BlitWorldTriangle(Target& target, const PipelineState3D& state, const Camera3D& camera, const Screen& screen, const Triangle3D& triangle, const glm::mat4& transform) const
     {
+        auto clip = glm::vec2(screen.width, screen.height);
+        SetupWorldTriangle(camera, screen, triangle, transform, [&](const Triangle3D& flat) { BlitFlatTriangle(target, state, clip, flat); });
+    }
+    
+    // blits the given 3D model's triangles to the given target with the given pipeline state
+    inline void Blit3DModel(Target& target, const PipelineState3D& state, const Camera3D& camera, const Screen& screen, const Model3D& model, const glm::mat4& transform = glm::mat4(1.0f)) const
+    {
+        for (auto& triangle: model.triangles)
+        {
+            BlitWorldTriangle(target, state, camera, screen, triangle, transform);
+        }
+    }
+    
+    // blits the given 3D model's triangles to the given target with the renderer's own state
+    inline void Blit3DModel(Target& target, const Camera3D& camera, const Screen& screen, const Model3D& model, const glm::mat4& transform = glm::mat4(1.0f)) const
+    {
+        Blit3DModel(target, state, camera, screen, model, transform);
+    }
+    
+    // blits the given quantized 3D model's triangles to the given target with the given pipeline state (the model's
+    // dequantize matrix is folded into the transform, so its positions never get turned back into floats on their own)
+    inline void Blit3DModel(Target& target, const PipelineState3D& state, const Camera3D& camera, const Screen& screen, const QuantizedModel3D& model, const glm::mat4& transform = glm::mat4(1.0f)) const
+    {
+        auto to_world = transform * model.dequantize;
+        
         for (auto& triangle: model.triangles)
         {
-            BlitWorldTriangle(target, camera, screen, triangle, transform);
+            BlitWorldTriangle(target, state, camera, screen, triangle.Expand(), to_world);
         }
     }
-};
\ No newline at end of file
+    
+    // blits the given quantized 3D model's triangles to the given target with the renderer's own state
+    inline void Blit3DModel(Target& target, const Camera3D& camera, const Screen& screen, const QuantizedModel3D& model, const glm::mat4& transform = glm::mat4(1.0f)) const
+    {
+        Blit3DModel(target, state, camera, screen, model, transform);
+    }
+};
+
+
+// a model placed in the scene, along with the state it gets drawn with
+struct Instance3D
+{
+    const Model3D* model = nullptr;
+    PipelineState3D state;
+    glm::mat4 transform = glm::mat4(1.0f);
+};
+
+
+// whether two instances would draw exactly the same pixels
+inline bool operator==(const Instance3D& a, const Instance3D& b)
+{
+    return
+        a.model == b.model && a.state.sampler == b.state.sampler && a.state.virtual_texture == b.state.virtual_texture &&
+        a.state.shading_rate == b.state.shading_rate && a.state.linear_light == b.state.linear_light && a.transform == b.transform;
+}
\ No newline at end of file
@@ -1,9 +1,12 @@
 #pragma once
 #include <algorithm>
+#include <chrono>
+#include <cstring>
 
 #include <SDL2/SDL.h>
 
 #include "math.hpp"
+#include "image.hpp"
 
 
 // blits a single colored pixel onto the given surface at the given point
@@ -31,9 +34,23 @@ inline void SDL_BlitBig(SDL_Surface* surface, int x, int y, const SDL_Color& col
 }
 
 
+// returns a pointer to the first pixel of the given row of a 32 bit surface
+inline Uint32* SDL_GetPixelRow(SDL_Surface* surface, int y)
+{
+    return (Uint32*)((Uint8*)surface->pixels + y * surface->pitch);
+}
+
+
 // reads the color of a single pixel in the given surface
 inline SDL_Color SDL_ReadPixel(SDL_Surface* surface, int x, int y)
 {
+    // RGB565 surfaces are common enough on small devices to be worth decoding without going through SDL
+    if (surface->format->format == SDL_PIXELFORMAT_RGB565)
+    {
+        auto color = UnpackRGB565(((Uint16*)((Uint8*)surface->pixels + y * surface->pitch))[x]);
+        return SDL_Color{ color.r, color.g, color.b, color.a };
+    }
+    
     int bpp = surface->format->BytesPerPixel;
     Uint8* pixel_data = (Uint8*)surface->pixels + y * surface->pitch + x * bpp;
     
@@ -76,4 +93,58 @@ inline SDL_Color SDL_Sample(SDL_Surface* surface, float u, float v)
     { return SDL_ReadPixel(surface, std::min(x, surface->w - 1), std::min(y, surface->h - 1)); }
     else
     { return { 0, 0, 0, 255 }; }
+}
+
+
+// wraps the pixels of an ARGB8888 or RGB565 surface in an image, so that the renderer can draw straight into it
+// (the surface must outlive the image, and any other format results in an empty image)
+inline Image3D SDL_WrapSurface(SDL_Surface* surface)
+{
+    if (surface == nullptr)
+    { return Image3D(); }
+    
+    switch (surface->format->format)
+    {
+        case SDL_PIXELFORMAT_ARGB8888:
+            return Image3D::Wrap(surface->pixels, surface->w, surface->h, surface->pitch, PixelFormat3D::ARGB8888);
+        
+        case SDL_PIXELFORMAT_RGB565:
+            return Image3D::Wrap(surface->pixels, surface->w, surface->h, surface->pitch, PixelFormat3D::RGB565);
+        
+        default:
+            return Image3D();
+    }
+}
+
+
+// copies a surface of any format into a new ARGB8888 image (for example, to use an image loaded by SDL_image as a texture)
+inline Image3D SDL_CopySurface(SDL_Surface* surface)
+{
+    if (surface == nullptr)
+    { return Image3D(); }
+    
+    // let SDL deal with whatever format the surface is in
+    auto converted = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+    
+    if (converted == nullptr)
+    { return Image3D(); }
+    
+    Image3D image(converted->w, converted->h, PixelFormat3D::ARGB8888);
+    
+    for (int y = 0; y < converted->h; ++y)
+    {
+        std::memcpy(image.GetRow(y), SDL_GetPixelRow(converted, y), converted->w * sizeof(Uint32));
+    }
+    
+    SDL_FreeSurface(converted);
+    return image;
+}
+
+
+// turns the timestamp of an SDL event into a point in time of the steady clock, so it can be compared with times taken
+// after it (event timestamps only have millisecond precision)
+inline std::chrono::steady_clock::time_point SDL_GetEventTime(Uint32 timestamp)
+{
+    auto age = std::chrono::milliseconds(SDL_GetTicks() - timestamp);
+    return std::chrono::steady_clock::now() - age;
 }
\ No newline at end of file
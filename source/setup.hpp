@@ -0,0 +1,148 @@
+#pragma once
+#include <cmath>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "color.hpp"
+#include "renderer.hpp"
+
+
+// the screen space triangles one model was set up into for a given transform, ready to be rasterized
+struct TriangleSetup3D
+{
+    // what the triangles were set up from (the model's triangles are remembered too, to notice them being replaced)
+    const Model3D* model = nullptr;
+    const Triangle3D* source = nullptr;
+    size_t source_count = 0;
+    glm::mat4 transform = glm::mat4(1.0f);
+    
+    // which view the triangles were set up for, and when they were last used
+    Uint64 view_version = 0;
+    Uint64 last_used = 0;
+    
+    // flat topped or bottomed screen space triangles, along with the tiles each of them could draw to
+    std::vector<Triangle3D> triangles;
+    std::vector<TileRect3D> tiles;
+};
+
+
+// keeps the screen space triangles models get turned into before being rasterized, and reuses them for as long as the
+// camera, the screen and a model's transform stay the same, so that frames from a still camera skip transforming,
+// clipping, projecting and splitting triangles entirely
+// (a cache can only be used by one thread at a time, so give every thread drawing with one its own)
+struct TriangleSetupCache3D
+{
+    // how many model and transform pairs are remembered at once before the least recently used one is replaced
+    size_t max_entries = 256;
+    
+    std::vector<TriangleSetup3D> entries;
+    
+    // the view every entry with the current view version was set up for
+    Camera3D camera{ glm::vec3(0.0f), 0.0f, 0.0f };
+    Screen screen{ 0.0f, 0.0f, 0.0f };
+    Uint64 view_version = 1;
+    Uint64 uses = 0;
+    bool has_view = false;
+    
+    // how many setups were reused and how many had to be redone
+    size_t hits = 0;
+    size_t misses = 0;
+    
+    // makes every entry get set up again on its next use (do this after changing a model's triangles in place)
+    inline void Invalidate()
+    {
+        view_version += 1;
+    }
+    
+    // returns the set up triangles of the given model, setting them up again if anything they depend on changed
+    // (the result is only valid until the next call)
+    inline const TriangleSetup3D& Setup(const Renderer3D& renderer, const Camera3D& camera, const Screen& screen, const Model3D& model, const glm::mat4& transform = glm::mat4(1.0f))
+    {
+        // a different view makes every entry out of date at once
+        if (!has_view || !(camera == this->camera) || !(screen == this->screen))
+        {
+            this->camera = camera;
+            this->screen = screen;
+            has_view = true;
+            Invalidate();
+        }
+        
+        uses += 1;
+        
+        // find the entry for this model and transform, or the one that went unused the longest to replace
+        TriangleSetup3D* entry = nullptr;
+        TriangleSetup3D* oldest = nullptr;
+        
+        for (auto& candidate: entries)
+        {
+            if (candidate.model == &model && candidate.transform == transform)
+            {
+                entry = &candidate;
+                break;
+            }
+            
+            if (oldest == nullptr || candidate.last_used < oldest->last_used)
+            { oldest = &candidate; }
+        }
+        
+        if (entry == nullptr)
+        {
+            if (entries.size() < max_entries || oldest == nullptr)
+            { entry = &entries.emplace_back(); }
+            else
+            { entry = oldest; }
+            
+            entry->model = &model;
+            entry->transform = transform;
+            entry->view_version = 0;
+        }
+        
+        entry->last_used = uses;
+        
+        if (entry->view_version == view_version && entry->source == model.triangles.data() && entry->source_count == model.triangles.size())
+        {
+            hits += 1;
+            return *entry;
+        }
+        
+        misses += 1;
+        
+        // run every triangle through the front end once, keeping what it hands to the rasterizer
+        entry->source = model.triangles.data();
+        entry->source_count = model.triangles.size();
+        entry->view_version = view_version;
+        entry->triangles.clear();
+        entry->tiles.clear();
+        
+        for (auto& triangle: model.triangles)
+        {
+            renderer.SetupWorldTriangle(camera, screen, triangle, transform, [&](const Triangle3D& flat)
+            {
+                auto& verts = flat.vertices;
+                auto min = glm::min(glm::min(glm::vec2(verts[0].pos), glm::vec2(verts[1].pos)), glm::vec2(verts[2].pos));
+                auto max = glm::max(glm::max(glm::vec2(verts[0].pos), glm::vec2(verts[1].pos)), glm::vec2(verts[2].pos));
+                
+                entry->triangles.push_back(flat);
+                entry->tiles.push_back(GetTileRect(min, max));
+            });
+        }
+        
+        return *entry;
+    }
+    
+    // blits the given model like Renderer3D::Blit3DModel does, but with triangles set up by this cache (triangles that
+    // only cover tiles the target currently masks out are skipped without being looked at)
+    inline void Blit3DModel(const Renderer3D& renderer, Target& target, const PipelineState3D& state, const Camera3D& camera, const Screen& screen, const Model3D& model, const glm::mat4& transform = glm::mat4(1.0f))
+    {
+        auto& setup = Setup(renderer, camera, screen, model, transform);
+        auto clip = glm::vec2(screen.width, screen.height);
+        auto masked = !target.tile_mask.empty();
+        
+        for (size_t i = 0; i < setup.triangles.size(); ++i)
+        {
+            if (!masked || target.IsAnyTileWritable(setup.tiles[i]))
+            { renderer.BlitFlatTriangle(target, state, clip, setup.triangles[i]); }
+        }
+    }
+};
\ No newline at end of file
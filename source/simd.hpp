@@ -0,0 +1,595 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "color.hpp"
+
+// pick the vector instruction set to build the native kernels with (define SMOLSOFT3D_NO_SIMD to only build scalar ones)
+// (NEON kernels need 64 bit ARM, since 32 bit ARM has no vector division)
+#if !defined(SMOLSOFT3D_NO_SIMD) && ((defined(__ARM_NEON) && defined(__aarch64__)) || defined(_M_ARM64))
+#define SMOLSOFT3D_NEON
+#include <arm_neon.h>
+#elif !defined(SMOLSOFT3D_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SMOLSOFT3D_SSE2
+#include <emmintrin.h>
+#endif
+
+
+// the instruction sets kernels can be implemented with
+enum class SimdBackend
+{
+    Scalar,
+    SSE2,
+    NEON,
+};
+
+
+// the best instruction set this build can use
+#if defined(SMOLSOFT3D_NEON)
+constexpr SimdBackend native_simd_backend = SimdBackend::NEON;
+#elif defined(SMOLSOFT3D_SSE2)
+constexpr SimdBackend native_simd_backend = SimdBackend::SSE2;
+#else
+constexpr SimdBackend native_simd_backend = SimdBackend::Scalar;
+#endif
+
+
+// returns a readable name for the given instruction set
+inline const char* GetSimdBackendName(SimdBackend backend)
+{
+    switch (backend)
+    {
+        case SimdBackend::SSE2:
+            return "sse2";
+        
+        case SimdBackend::NEON:
+            return "neon";
+        
+        default:
+            return "scalar";
+    }
+}
+
+
+// a set of span kernels implemented with a single instruction set, which every backend implements identically
+// (integer kernels produce the exact same results on every backend, float kernels might differ in the last bit, apart
+// from reciprocal, which only the scalar backend computes exactly)
+struct SimdKernels3D
+{
+    // fills count 32 bit pixels with a single value (used to clear color buffers)
+    void (*fill_pixels)(Uint32* dst, size_t count, Uint32 value);
+    
+    // fills count floats with a single value (used to clear depth buffers)
+    void (*fill_depth)(float* dst, size_t count, float value);
+    
+    // multiplies two spans of 32 bit pixels one 8 bit channel at a time, rounding a * b / 255 to the nearest integer
+    // (the same blend Blend does, on packed pixels)
+    void (*modulate_pixels)(Uint32* dst, const Uint32* a, const Uint32* b, size_t count);
+    
+    // multiplies two spans of 32 bit pixels in linear light through the sRGB lookup tables (the same blend BlendLinear
+    // does, on packed pixels, with alpha multiplied like modulate_pixels does)
+    void (*modulate_pixels_linear)(Uint32* dst, const Uint32* a, const Uint32* b, size_t count);
+    
+    // samples the closest texel of a 32 bit texture at each pair of normalized coordinates (like SDL_Sample, with
+    // coordinates outside of the texture sampling opaque black)
+    void (*sample_nearest)(Uint32* dst, const Uint32* texels, int width, int height, int pitch, const float* u, const float* v, size_t count);
+    
+    // works out the depth of count pixels along a span from its perspective divided depth and 1/z, which both change
+    // linearly across it, and whether each one passes the depth test against the depth buffer (1) or not (0)
+    void (*depth_span)(float* dst, Uint8* pass, const float* depth_buffer, size_t count, float depth_w, float depth_w_step, float w, float w_step);
+    
+    // works out 1 / x for count floats, dividing on the scalar backend and refining the hardware's reciprocal estimate
+    // on the others, the same way FastReciprocal does (used to trade precision for speed in perspective divides)
+    void (*reciprocal)(float* dst, const float* x, size_t count);
+};
+
+
+// approximates 1 / x with the hardware's reciprocal estimate refined by Newton-Raphson steps, to within a couple of
+// units in the last place of the exact result, or divides on builds without vector instructions
+// (only meant for finite values other than 0, like the w of vertices in front of the near plane)
+inline float FastReciprocal(float x)
+{
+#if defined(SMOLSOFT3D_SSE2)
+    // the estimate is good to 12 bits, and each step of r * (2 - x * r) roughly doubles that
+    auto value = _mm_set_ss(x);
+    auto estimate = _mm_rcp_ss(value);
+    return _mm_cvtss_f32(_mm_mul_ss(estimate, _mm_sub_ss(_mm_set_ss(2.0f), _mm_mul_ss(value, estimate))));
+#elif defined(SMOLSOFT3D_NEON)
+    // the estimate is only good to 8 bits, so it takes two steps (vrecps works out 2 - x * r on its own)
+    auto value = vdup_n_f32(x);
+    auto estimate = vrecpe_f32(value);
+    estimate = vmul_f32(estimate, vrecps_f32(value, estimate));
+    estimate = vmul_f32(estimate, vrecps_f32(value, estimate));
+    return vget_lane_f32(estimate, 0);
+#else
+    return 1.0f / x;
+#endif
+}
+
+
+// scalar kernels, which every other backend falls back to for the last few pixels of a span
+inline void FillPixelsScalar(Uint32* dst, size_t count, Uint32 value)
+{
+    for (size_t i = 0; i < count; ++i)
+    { dst[i] = value; }
+}
+
+
+inline void FillDepthScalar(float* dst, size_t count, float value)
+{
+    for (size_t i = 0; i < count; ++i)
+    { dst[i] = value; }
+}
+
+
+inline void ModulatePixelsScalar(Uint32* dst, const Uint32* a, const Uint32* b, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        Uint32 result = 0;
+        
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            // exact rounded division by 255, without dividing
+            Uint32 product = ((a[i] >> shift) & 0xFF) * ((b[i] >> shift) & 0xFF) + 128;
+            result |= ((product + (product >> 8)) >> 8) << shift;
+        }
+        
+        dst[i] = result;
+    }
+}
+
+
+inline void ModulatePixelsLinearScalar(Uint32* dst, const Uint32* a, const Uint32* b, size_t count)
+{
+    auto& tables = GetSrgbTables();
+    
+    for (size_t i = 0; i < count; ++i)
+    {
+        Uint32 alpha = (a[i] >> 24) * (b[i] >> 24) + 128;
+        Uint32 result = ((alpha + (alpha >> 8)) >> 8) << 24;
+        
+        for (int shift = 0; shift < 24; shift += 8)
+        {
+            result |= (Uint32)tables.Modulate((a[i] >> shift) & 0xFF, (b[i] >> shift) & 0xFF) << shift;
+        }
+        
+        dst[i] = result;
+    }
+}
+
+
+inline void SampleNearestScalar(Uint32* dst, const Uint32* texels, int width, int height, int pitch, const float* u, const float* v, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto x = (int)(u[i] * (float)width);
+        auto y = (int)((float)height + v[i] * (0.0f - (float)height));
+        
+        if (x >= 0 && x <= width && y >= 0 && y <= height)
+        { dst[i] = texels[std::min(y, height - 1) * pitch + std::min(x, width - 1)]; }
+        else
+        { dst[i] = 0xFF000000; }
+    }
+}
+
+
+inline void DepthSpanScalar(float* dst, Uint8* pass, const float* depth_buffer, size_t count, float depth_w, float depth_w_step, float w, float w_step)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto depth = (depth_w + (float)i * depth_w_step) / (w + (float)i * w_step) / 10000.0f;
+        dst[i] = depth;
+        pass[i] = depth < depth_buffer[i];
+    }
+}
+
+
+inline void ReciprocalScalar(float* dst, const float* x, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    { dst[i] = 1.0f / x[i]; }
+}
+
+
+#if defined(SMOLSOFT3D_SSE2)
+
+// SSE2 kernels, which process four pixels at a time and are available on every x86-64 processor
+inline void FillPixelsSSE2(Uint32* dst, size_t count, Uint32 value)
+{
+    auto values = _mm_set1_epi32((int)value);
+    size_t i = 0;
+    
+    for (; i + 4 <= count; i += 4)
+    { _mm_storeu_si128((__m128i*)(dst + i), values); }
+    
+    FillPixelsScalar(dst + i, count - i, value);
+}
+
+
+inline void FillDepthSSE2(float* dst, size_t count, float value)
+{
+    auto values = _mm_set1_ps(value);
+    size_t i = 0;
+    
+    for (; i + 4 <= count; i += 4)
+    { _mm_storeu_ps(dst + i, values); }
+    
+    FillDepthScalar(dst + i, count - i, value);
+}
+
+
+// multiplies the sixteen 8 bit channels of four packed pixels, rounding a * b / 255 to the nearest integer
+inline __m128i ModulateChannelsSSE2(__m128i pixels_a, __m128i pixels_b)
+{
+    auto zero = _mm_setzero_si128();
+    auto half = _mm_set1_epi16(128);
+    
+    // widen channels to 16 bits, multiply them, and divide them by 255 the same way the scalar kernel does
+    auto lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pixels_a, zero), _mm_unpacklo_epi8(pixels_b, zero)), half);
+    auto hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pixels_a, zero), _mm_unpackhi_epi8(pixels_b, zero)), half);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+    
+    return _mm_packus_epi16(lo, hi);
+}
+
+
+inline void ModulatePixelsSSE2(Uint32* dst, const Uint32* a, const Uint32* b, size_t count)
+{
+    size_t i = 0;
+    
+    for (; i + 4 <= count; i += 4)
+    {
+        auto pixels_a = _mm_loadu_si128((const __m128i*)(a + i));
+        auto pixels_b = _mm_loadu_si128((const __m128i*)(b + i));
+        _mm_storeu_si128((__m128i*)(dst + i), ModulateChannelsSSE2(pixels_a, pixels_b));
+    }
+    
+    ModulatePixelsScalar(dst + i, a + i, b + i, count - i);
+}
+
+
+inline void ModulatePixelsLinearSSE2(Uint32* dst, const Uint32* a, const Uint32* b, size_t count)
+{
+    auto& tables = GetSrgbTables();
+    auto half = _mm_set1_epi32(2048);
+    size_t i = 0;
+    
+    // SSE2 has no gather, so channels are looked up one at a time, but they're multiplied and divided eight at a time
+    alignas(16) Uint16 linear_a[16];
+    alignas(16) Uint16 linear_b[16];
+    alignas(16) Uint32 products[16];
+    alignas(16) Uint32 alphas[4];
+    
+    for (; i + 4 <= count; i += 4)
+    {
+        auto pixels_a = _mm_loadu_si128((const __m128i*)(a + i));
+        auto pixels_b = _mm_loadu_si128((const __m128i*)(b + i));
+        _mm_store_si128((__m128i*)alphas, ModulateChannelsSSE2(pixels_a, pixels_b));
+        
+        for (int j = 0; j < 16; ++j)
+        {
+            linear_a[j] = tables.to_linear[((const Uint8*)(a + i))[j]];
+            linear_b[j] = tables.to_linear[((const Uint8*)(b + i))[j]];
+        }
+        
+        for (int j = 0; j < 16; j += 8)
+        {
+            // 12 bit products need 24 bits, so the low and high halves of each one are multiplied separately
+            auto channels_a = _mm_load_si128((const __m128i*)(linear_a + j));
+            auto channels_b = _mm_load_si128((const __m128i*)(linear_b + j));
+            auto product_lo = _mm_mullo_epi16(channels_a, channels_b);
+            auto product_hi = _mm_mulhi_epu16(channels_a, channels_b);
+            
+            auto lo = _mm_add_epi32(_mm_unpacklo_epi16(product_lo, product_hi), half);
+            auto hi = _mm_add_epi32(_mm_unpackhi_epi16(product_lo, product_hi), half);
+            lo = _mm_srli_epi32(_mm_add_epi32(lo, _mm_srli_epi32(lo, 12)), 12);
+            hi = _mm_srli_epi32(_mm_add_epi32(hi, _mm_srli_epi32(hi, 12)), 12);
+            
+            _mm_store_si128((__m128i*)(products + j), lo);
+            _mm_store_si128((__m128i*)(products + j + 4), hi);
+        }
+        
+        for (int j = 0; j < 4; ++j)
+        {
+            auto product = products + j * 4;
+            dst[i + j] = (alphas[j] & 0xFF000000) | ((Uint32)tables.to_srgb[product[2]] << 16) |
+                ((Uint32)tables.to_srgb[product[1]] << 8) | tables.to_srgb[product[0]];
+        }
+    }
+    
+    ModulatePixelsLinearScalar(dst + i, a + i, b + i, count - i);
+}
+
+
+inline void SampleNearestSSE2(Uint32* dst, const Uint32* texels, int width, int height, int pitch, const float* u, const float* v, size_t count)
+{
+    auto widths = _mm_set1_ps((float)width);
+    auto heights = _mm_set1_ps((float)height);
+    auto negative_heights = _mm_set1_ps(0.0f - (float)height);
+    size_t i = 0;
+    
+    // coordinates are worked out four at a time, but SSE2 has no gather so texels are still read one at a time
+    alignas(16) int xs[4];
+    alignas(16) int ys[4];
+    
+    for (; i + 4 <= count; i += 4)
+    {
+        auto x = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(u + i), widths));
+        auto y = _mm_cvttps_epi32(_mm_add_ps(heights, _mm_mul_ps(_mm_loadu_ps(v + i), negative_heights)));
+        _mm_store_si128((__m128i*)xs, x);
+        _mm_store_si128((__m128i*)ys, y);
+        
+        for (int j = 0; j < 4; ++j)
+        {
+            if (xs[j] >= 0 && xs[j] <= width && ys[j] >= 0 && ys[j] <= height)
+            { dst[i + j] = texels[std::min(ys[j], height - 1) * pitch + std::min(xs[j], width - 1)]; }
+            else
+            { dst[i + j] = 0xFF000000; }
+        }
+    }
+    
+    SampleNearestScalar(dst + i, texels, width, height, pitch, u + i, v + i, count - i);
+}
+
+
+inline void DepthSpanSSE2(float* dst, Uint8* pass, const float* depth_buffer, size_t count, float depth_w, float depth_w_step, float w, float w_step)
+{
+    auto steps = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    auto depth_w_steps = _mm_set1_ps(depth_w_step);
+    auto w_steps = _mm_set1_ps(w_step);
+    auto scale = _mm_set1_ps(10000.0f);
+    size_t i = 0;
+    
+    for (; i + 4 <= count; i += 4)
+    {
+        auto index = _mm_add_ps(_mm_set1_ps((float)i), steps);
+        auto numerator = _mm_add_ps(_mm_set1_ps(depth_w), _mm_mul_ps(index, depth_w_steps));
+        auto denominator = _mm_add_ps(_mm_set1_ps(w), _mm_mul_ps(index, w_steps));
+        auto depth = _mm_div_ps(_mm_div_ps(numerator, denominator), scale);
+        
+        _mm_storeu_ps(dst + i, depth);
+        
+        auto mask = _mm_movemask_ps(_mm_cmplt_ps(depth, _mm_loadu_ps(depth_buffer + i)));
+        pass[i + 0] = (mask >> 0) & 1;
+        pass[i + 1] = (mask >> 1) & 1;
+        pass[i + 2] = (mask >> 2) & 1;
+        pass[i + 3] = (mask >> 3) & 1;
+    }
+    
+    // the scalar kernel counts steps from the start of the span, so the rest of it starts where the loop left off
+    DepthSpanScalar(dst + i, pass + i, depth_buffer + i, count - i, depth_w + (float)i * depth_w_step, depth_w_step, w + (float)i * w_step, w_step);
+}
+
+
+inline void ReciprocalSSE2(float* dst, const float* x, size_t count)
+{
+    auto twos = _mm_set1_ps(2.0f);
+    size_t i = 0;
+    
+    for (; i + 4 <= count; i += 4)
+    {
+        auto values = _mm_loadu_ps(x + i);
+        auto estimate = _mm_rcp_ps(values);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(estimate, _mm_sub_ps(twos, _mm_mul_ps(values, estimate))));
+    }
+    
+    // the last few values are estimated too, rather than divided, so the whole span is equally precise
+    for (; i < count; ++i)
+    { dst[i] = FastReciprocal(x[i]); }
+}
+
+#endif
+
+
+#if defined(SMOLSOFT3D_NEON)
+
+// NEON kernels, which process four pixels at a time (sixteen channels for integer kernels) on ARM processors
+inline void FillPixelsNEON(Uint32* dst, size_t count, Uint32 value)
+{
+    auto values = vdupq_n_u32(value);
+    size_t i = 0;
+    
+    for (; i + 4 <= count; i += 4)
+    { vst1q_u32(dst + i, values); }
+    
+    FillPixelsScalar(dst + i, count - i, value);
+}
+
+
+inline void FillDepthNEON(float* dst, size_t count, float value)
+{
+    auto values = vdupq_n_f32(value);
+    size_t i = 0;
+    
+    for (; i + 4 <= count; i += 4)
+    { vst1q_f32(dst + i, values); }
+    
+    FillDepthScalar(dst + i, count - i, value);
+}
+
+
+// multiplies the sixteen 8 bit channels of four packed pixels, rounding a * b / 255 to the nearest integer
+inline uint8x16_t ModulateChannelsNEON(uint8x16_t channels_a, uint8x16_t channels_b)
+{
+    // widening multiplies, then a rounding shift and accumulate followed by a rounding narrowing shift, which works out
+    // to exactly the same division by 255 as the scalar kernel
+    auto lo = vmull_u8(vget_low_u8(channels_a), vget_low_u8(channels_b));
+    auto hi = vmull_u8(vget_high_u8(channels_a), vget_high_u8(channels_b));
+    return vcombine_u8(vrshrn_n_u16(vrsraq_n_u16(lo, lo, 8), 8), vrshrn_n_u16(vrsraq_n_u16(hi, hi, 8), 8));
+}
+
+
+inline void ModulatePixelsNEON(Uint32* dst, const Uint32* a, const Uint32* b, size_t count)
+{
+    size_t i = 0;
+    
+    for (; i + 4 <= count; i += 4)
+    {
+        auto channels_a = vld1q_u8((const Uint8*)(a + i));
+        auto channels_b = vld1q_u8((const Uint8*)(b + i));
+        vst1q_u8((Uint8*)(dst + i), ModulateChannelsNEON(channels_a, channels_b));
+    }
+    
+    ModulatePixelsScalar(dst + i, a + i, b + i, count - i);
+}
+
+
+inline void ModulatePixelsLinearNEON(Uint32* dst, const Uint32* a, const Uint32* b, size_t count)
+{
+    auto& tables = GetSrgbTables();
+    auto half = vdupq_n_u32(2048);
+    size_t i = 0;
+    
+    // NEON has no gather, so channels are looked up one at a time, but they're multiplied and divided eight at a time
+    Uint16 linear_a[16];
+    Uint16 linear_b[16];
+    Uint32 products[16];
+    Uint32 alphas[4];
+    
+    for (; i + 4 <= count; i += 4)
+    {
+        auto channels_a = vld1q_u8((const Uint8*)(a + i));
+        auto channels_b = vld1q_u8((const Uint8*)(b + i));
+        vst1q_u32(alphas, vreinterpretq_u32_u8(ModulateChannelsNEON(channels_a, channels_b)));
+        
+        for (int j = 0; j < 16; ++j)
+        {
+            linear_a[j] = tables.to_linear[((const Uint8*)(a + i))[j]];
+            linear_b[j] = tables.to_linear[((const Uint8*)(b + i))[j]];
+        }
+        
+        for (int j = 0; j < 16; j += 8)
+        {
+            auto values_a = vld1q_u16(linear_a + j);
+            auto values_b = vld1q_u16(linear_b + j);
+            auto lo = vaddq_u32(vmull_u16(vget_low_u16(values_a), vget_low_u16(values_b)), half);
+            auto hi = vaddq_u32(vmull_u16(vget_high_u16(values_a), vget_high_u16(values_b)), half);
+            
+            vst1q_u32(products + j, vshrq_n_u32(vaddq_u32(lo, vshrq_n_u32(lo, 12)), 12));
+            vst1q_u32(products + j + 4, vshrq_n_u32(vaddq_u32(hi, vshrq_n_u32(hi, 12)), 12));
+        }
+        
+        for (int j = 0; j < 4; ++j)
+        {
+            auto product = products + j * 4;
+            dst[i + j] = (alphas[j] & 0xFF000000) | ((Uint32)tables.to_srgb[product[2]] << 16) |
+                ((Uint32)tables.to_srgb[product[1]] << 8) | tables.to_srgb[product[0]];
+        }
+    }
+    
+    ModulatePixelsLinearScalar(dst + i, a + i, b + i, count - i);
+}
+
+
+inline void SampleNearestNEON(Uint32* dst, const Uint32* texels, int width, int height, int pitch, const float* u, const float* v, size_t count)
+{
+    auto widths = vdupq_n_f32((float)width);
+    auto heights = vdupq_n_f32((float)height);
+    auto negative_heights = vdupq_n_f32(0.0f - (float)height);
+    size_t i = 0;
+    
+    // coordinates are worked out four at a time, but NEON has no gather so texels are still read one at a time
+    int32_t xs[4];
+    int32_t ys[4];
+    
+    for (; i + 4 <= count; i += 4)
+    {
+        vst1q_s32(xs, vcvtq_s32_f32(vmulq_f32(vld1q_f32(u + i), widths)));
+        vst1q_s32(ys, vcvtq_s32_f32(vaddq_f32(heights, vmulq_f32(vld1q_f32(v + i), negative_heights))));
+        
+        for (int j = 0; j < 4; ++j)
+        {
+            if (xs[j] >= 0 && xs[j] <= width && ys[j] >= 0 && ys[j] <= height)
+            { dst[i + j] = texels[std::min(ys[j], height - 1) * pitch + std::min(xs[j], width - 1)]; }
+            else
+            { dst[i + j] = 0xFF000000; }
+        }
+    }
+    
+    SampleNearestScalar(dst + i, texels, width, height, pitch, u + i, v + i, count - i);
+}
+
+
+inline void DepthSpanNEON(float* dst, Uint8* pass, const float* depth_buffer, size_t count, float depth_w, float depth_w_step, float w, float w_step)
+{
+    const float step_values[4]{ 0.0f, 1.0f, 2.0f, 3.0f };
+    auto steps = vld1q_f32(step_values);
+    auto depth_w_steps = vdupq_n_f32(depth_w_step);
+    auto w_steps = vdupq_n_f32(w_step);
+    auto scale = vdupq_n_f32(10000.0f);
+    size_t i = 0;
+    
+    Uint32 masks[4];
+    
+    for (; i + 4 <= count; i += 4)
+    {
+        // separate multiplies and adds rather than fused ones, so results match the other backends
+        auto index = vaddq_f32(vdupq_n_f32((float)i), steps);
+        auto numerator = vaddq_f32(vdupq_n_f32(depth_w), vmulq_f32(index, depth_w_steps));
+        auto denominator = vaddq_f32(vdupq_n_f32(w), vmulq_f32(index, w_steps));
+        auto depth = vdivq_f32(vdivq_f32(numerator, denominator), scale);
+        
+        vst1q_f32(dst + i, depth);
+        vst1q_u32(masks, vcltq_f32(depth, vld1q_f32(depth_buffer + i)));
+        
+        pass[i + 0] = masks[0] & 1;
+        pass[i + 1] = masks[1] & 1;
+        pass[i + 2] = masks[2] & 1;
+        pass[i + 3] = masks[3] & 1;
+    }
+    
+    DepthSpanScalar(dst + i, pass + i, depth_buffer + i, count - i, depth_w + (float)i * depth_w_step, depth_w_step, w + (float)i * w_step, w_step);
+}
+
+
+inline void ReciprocalNEON(float* dst, const float* x, size_t count)
+{
+    size_t i = 0;
+    
+    for (; i + 4 <= count; i += 4)
+    {
+        auto values = vld1q_f32(x + i);
+        auto estimate = vrecpeq_f32(values);
+        estimate = vmulq_f32(estimate, vrecpsq_f32(values, estimate));
+        estimate = vmulq_f32(estimate, vrecpsq_f32(values, estimate));
+        vst1q_f32(dst + i, estimate);
+    }
+    
+    for (; i < count; ++i)
+    { dst[i] = FastReciprocal(x[i]); }
+}
+
+#endif
+
+
+// returns the kernels implemented with the given instruction set, or the scalar ones if this build can't use it
+inline const SimdKernels3D& GetSimdKernels(SimdBackend backend)
+{
+    static const SimdKernels3D scalar{ FillPixelsScalar, FillDepthScalar, ModulatePixelsScalar, ModulatePixelsLinearScalar, SampleNearestScalar, DepthSpanScalar, ReciprocalScalar };
+
+#if defined(SMOLSOFT3D_SSE2)
+    static const SimdKernels3D sse2{ FillPixelsSSE2, FillDepthSSE2, ModulatePixelsSSE2, ModulatePixelsLinearSSE2, SampleNearestSSE2, DepthSpanSSE2, ReciprocalSSE2 };
+    
+    if (backend == SimdBackend::SSE2)
+    { return sse2; }
+#endif
+
+#if defined(SMOLSOFT3D_NEON)
+    static const SimdKernels3D neon{ FillPixelsNEON, FillDepthNEON, ModulatePixelsNEON, ModulatePixelsLinearNEON, SampleNearestNEON, DepthSpanNEON, ReciprocalNEON };
+    
+    if (backend == SimdBackend::NEON)
+    { return neon; }
+#endif
+
+    return scalar;
+}
+
+
+// returns the fastest kernels this build can use
+inline const SimdKernels3D& GetSimdKernels()
+{
+    return GetSimdKernels(native_simd_backend);
+}
\ No newline at end of file
@@ -0,0 +1,346 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "color.hpp"
+#include "image.hpp"
+#include "renderer.hpp"
+#include "commands.hpp"
+
+
+// how the sizes of stress scene triangles are spread between the smallest and biggest
+enum class StressSizes3D
+{
+    // every size is as likely
+    Uniform,
+    
+    // every doubling of size is as likely, so most triangles are small and a few are big, like in real scenes
+    LogUniform,
+};
+
+
+// which order stress scene triangles get drawn in
+enum class StressOrder3D
+{
+    // nearest first, so the depth test rejects every hidden pixel
+    FrontToBack,
+    
+    // furthest first, so every pixel of every triangle gets drawn
+    BackToFront,
+    
+    // in no particular order, so roughly the harmonic number of the depth complexity gets drawn per pixel
+    Random,
+};
+
+
+// settings for generating a stress scene
+struct StressSettings3D
+{
+    // how many triangles get drawn per frame, across every instance
+    size_t triangles = 10000;
+    
+    // how many times the scene's models get drawn per frame, each time with its own transform (models only hold
+    // triangles / instances triangles, so millions of triangles need plenty of instances to fit in memory)
+    size_t instances = 1;
+    
+    // how many images triangles sample from, each with a model of its own (0 draws untextured triangles)
+    int textures = 1;
+    int texture_size = 64;
+    
+    // how long the edges of triangles are on screen, in pixels (before they're scaled to fit the depth complexity)
+    float min_size = 1.5f;
+    float max_size = 8.0f;
+    StressSizes3D sizes = StressSizes3D::LogUniform;
+    
+    // how many triangles cover each pixel of the covered part of the screen on average (the covered part can't grow past
+    // the screen, so triangles with too much area between them to cover it this few times get scaled down until they
+    // don't, keeping their sizes relative to each other)
+    float depth_complexity = 2.0f;
+    StressOrder3D order = StressOrder3D::Random;
+    
+    // the target the scene is meant for
+    int width = 400;
+    int height = 240;
+    float fov = 60.0f;
+    
+    // scenes generated with the same settings draw from the same stream of random numbers everywhere (the scenes
+    // themselves can still differ by a bit here and there between standard libraries, since pow, cos and sin aren't
+    // required to round the same way on each of them)
+    Uint32 seed = 1;
+};
+
+
+// a generated scene, ready to be submitted
+// (models and images are referred to by index, so get the resources to submit with from GetResources once the scene
+// won't move anymore)
+struct StressScene3D
+{
+    StressSettings3D settings;
+    std::vector<Model3D> models;
+    std::vector<Image3D> images;
+    CommandBuffer3D buffer;
+    Screen screen{ 400.0f, 240.0f, 60.0f };
+    
+    // how many triangles get drawn per frame, how many cover each pixel of the covered part of the screen, and how much
+    // triangles were scaled down to make that the requested number (1 if they weren't)
+    size_t triangles = 0;
+    double depth_complexity = 0.0;
+    double size_scale = 1.0;
+    
+    // returns resources pointing at the scene's models and images, in the order its commands refer to them
+    inline CommandResources3D GetResources() const
+    {
+        CommandResources3D resources;
+        
+        for (size_t i = 0; i < models.size(); ++i)
+        {
+            resources.AddModel(models[i], "stress" + std::to_string(i));
+        }
+        
+        for (size_t i = 0; i < images.size(); ++i)
+        {
+            resources.AddImage(images[i], "stress" + std::to_string(i));
+        }
+        
+        return resources;
+    }
+};
+
+
+// generates a scene of triangles facing a camera at the origin, scattered over a disc in the middle of the screen
+// that's just big enough for them to cover it the requested number of times
+// (every instance draws every model, and instances sit in depth slices of their own and are rotated around the view
+// axis, which keeps every triangle the same size on screen and lets the draw order decide how much gets overdrawn)
+inline StressScene3D GenerateStressScene(const StressSettings3D& settings)
+{
+    StressScene3D scene;
+    scene.settings = settings;
+    scene.screen = Screen{ (float)settings.width, (float)settings.height, settings.fov };
+    
+    // a linear congruential generator rather than the standard distributions, whose streams differ between libraries
+    Uint32 state = settings.seed * 2654435761u + 12345u;
+    
+    auto next = [&]()
+    {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) / 16777216.0f;
+    };
+    
+    auto model_count = (size_t)std::max(1, settings.textures);
+    auto instances = std::max<size_t>(1, settings.instances);
+    auto per_model = std::max<size_t>(1, (settings.triangles + instances * model_count - 1) / (instances * model_count));
+    auto min_size = std::max(0.5f, std::min(settings.min_size, settings.max_size));
+    auto max_size = std::max(min_size, settings.max_size);
+    
+    // pick every triangle's size first, since how far apart they get spread depends on their total area
+    std::vector<float> sizes(per_model * model_count);
+    double area = 0.0;
+    
+    for (auto& size: sizes)
+    {
+        if (settings.sizes == StressSizes3D::Uniform)
+        { size = min_size + next() * (max_size - min_size); }
+        else
+        { size = min_size * std::pow(max_size / min_size, next()); }
+        
+        area += std::sqrt(3.0) / 4.0 * size * size * instances;
+    }
+    
+    // the disc can't grow past the screen, so when it would have to, triangles shrink instead (scaling their sizes scales
+    // their area by the square of that)
+    auto max_radius = std::min(settings.width, settings.height) / 2.0;
+    auto radius = std::sqrt(area / (3.14159265358979 * std::max(0.01f, settings.depth_complexity)));
+    
+    if (radius > max_radius)
+    {
+        scene.size_scale = max_radius / radius;
+        area *= scene.size_scale * scene.size_scale;
+        radius = max_radius;
+        
+        for (auto& size: sizes)
+        { size *= (float)scene.size_scale; }
+    }
+    
+    scene.triangles = sizes.size() * instances;
+    scene.depth_complexity = area / (3.14159265358979 * radius * radius);
+    
+    // every model sits in its own slice of depth within [1, 1 + 1 / instances), so that drawing models in order draws
+    // every triangle in order (in random order, every model spreads across all of their slices instead, so that draws
+    // of different models are just as mixed up in depth as triangles within one)
+    auto slice = 1.0f / (float)(instances * model_count);
+    auto random = settings.order == StressOrder3D::Random;
+    auto center = glm::vec2(settings.width / 2.0f, settings.height / 2.0f);
+    
+    for (size_t m = 0; m < model_count; ++m)
+    {
+        Model3D model;
+        model.triangles.reserve(per_model);
+        
+        for (size_t t = 0; t < per_model; ++t)
+        {
+            auto size = sizes[m * per_model + t];
+            auto extent = size / std::sqrt(3.0f);
+            
+            // uniformly spread over the disc
+            auto distance = (float)radius * std::sqrt(next());
+            auto direction = next() * 6.28318530718f;
+            auto middle = center + distance * glm::vec2(std::cos(direction), std::sin(direction));
+            auto depth = 1.0f + (random ? next() * (float)model_count : (float)m + next()) * slice;
+            
+            // a roughly equilateral triangle, with a patch of texture about as big as it is on screen
+            auto denominator = std::max((float)settings.texture_size, 2.0f * extent);
+            auto uv_center = glm::vec2(0.5f) + (glm::vec2(next(), next()) - 0.5f) * (1.0f - 2.0f * extent / denominator);
+            auto angle = next() * 6.28318530718f;
+            
+            Triangle3D triangle;
+            
+            for (int v = 0; v < 3; ++v)
+            {
+                auto corner_angle = angle + v * 2.09439510239f + (next() - 0.5f) * 0.6f;
+                auto offset = extent * glm::vec2(std::cos(corner_angle), std::sin(corner_angle));
+                auto pos = UnscaleFromScreen(glm::vec3(middle + offset, depth), scene.screen);
+                auto color = settings.textures > 0 ? glm::vec4(255.0f) : glm::vec4(next() * 255.0f, next() * 255.0f, next() * 255.0f, 255.0f);
+                
+                triangle.vertices[v] = Vertex3D(pos, color, uv_center + offset * glm::vec2(1.0f, -1.0f) / denominator);
+            }
+            
+            // triangles facing away from the camera don't get drawn
+            if (ScaleToScreen(triangle, scene.screen).GetWindingOrder() != 1)
+            { std::swap(triangle.vertices[1], triangle.vertices[2]); }
+            
+            model.triangles.push_back(triangle);
+        }
+        
+        if (settings.order != StressOrder3D::Random)
+        {
+            auto front_to_back = settings.order == StressOrder3D::FrontToBack;
+            
+            std::sort(model.triangles.begin(), model.triangles.end(), [&](auto& a, auto& b)
+            {
+                return front_to_back ? a.vertices[0].pos.z < b.vertices[0].pos.z : a.vertices[0].pos.z > b.vertices[0].pos.z;
+            });
+        }
+        
+        scene.models.push_back(std::move(model));
+    }
+    
+    // a checker pattern of two colors per image, 8 texels per square
+    for (int i = 0; i < settings.textures; ++i)
+    {
+        Image3D image(settings.texture_size, settings.texture_size, PixelFormat3D::ARGB8888);
+        Color3D colors[2];
+        
+        for (auto& color: colors)
+        {
+            color = Color3D{ (Uint8)(next() * 255.0f), (Uint8)(next() * 255.0f), (Uint8)(next() * 255.0f), 255 };
+        }
+        
+        for (int y = 0; y < image.height; ++y)
+        {
+            for (int x = 0; x < image.width; ++x)
+            {
+                image.WritePixel(x, y, image.Map(colors[(x / 8 + y / 8) & 1]));
+            }
+        }
+        
+        scene.images.push_back(image);
+    }
+    
+    // instances further back are scaled up around the camera, which moves them back without changing their size on
+    // screen, and rotated around the view axis, which keeps them within the disc
+    std::vector<glm::mat4> transforms(instances);
+    
+    for (size_t i = 0; i < instances; ++i)
+    {
+        auto scale = glm::scale(glm::mat4(1.0f), glm::vec3(2.0f * std::pow(1.0f + 1.0f / instances, (float)i)));
+        transforms[i] = glm::rotate(glm::mat4(1.0f), next() * 6.28318530718f, glm::vec3(0.0f, 0.0f, 1.0f)) * scale;
+    }
+    
+    if (settings.order == StressOrder3D::BackToFront)
+    {
+        std::reverse(transforms.begin(), transforms.end());
+    }
+    else if (random)
+    {
+        for (size_t i = instances; i > 1; --i)
+        {
+            std::swap(transforms[i - 1], transforms[std::min(i - 1, (size_t)(next() * i))]);
+        }
+    }
+    
+    auto& buffer = scene.buffer;
+    buffer.ClearSurface({ 0, 0, 0, 255 });
+    buffer.ClearDepth();
+    buffer.SetCamera(Camera3D{ glm::vec3(0.0f), 0.0f, 0.0f });
+    
+    for (auto& transform: transforms)
+    {
+        for (size_t m = 0; m < model_count; ++m)
+        {
+            auto model = settings.order == StressOrder3D::BackToFront ? model_count - 1 - m : m;
+            buffer.SetSampler(settings.textures > 0 ? (Uint32)model : CommandBuffer3D::none);
+            buffer.DrawModel((Uint32)model, transform);
+        }
+    }
+    
+    return scene;
+}
+
+
+// changes a single setting from text like "triangles=100000" (returns false for unknown settings or values)
+// (settings are triangles, instances, textures, texture_size, min_size, max_size, sizes (uniform or log),
+// depth_complexity, order (front, back or random), width, height, fov and seed)
+inline bool ParseStressSetting(StressSettings3D& settings, const std::string& text)
+{
+    auto equals = text.find('=');
+    
+    if (equals == std::string::npos)
+    { return false; }
+    
+    auto key = text.substr(0, equals);
+    auto value = text.substr(equals + 1);
+    auto number = std::atof(value.c_str());
+    
+    if (key == "triangles")
+    { settings.triangles = (size_t)std::max(1.0, number); }
+    else if (key == "instances")
+    { settings.instances = (size_t)std::max(1.0, number); }
+    else if (key == "textures")
+    { settings.textures = (int)std::max(0.0, number); }
+    else if (key == "texture_size")
+    { settings.texture_size = (int)std::max(1.0, number); }
+    else if (key == "min_size")
+    { settings.min_size = (float)number; }
+    else if (key == "max_size")
+    { settings.max_size = (float)number; }
+    else if (key == "depth_complexity")
+    { settings.depth_complexity = (float)number; }
+    else if (key == "width")
+    { settings.width = (int)std::max(1.0, number); }
+    else if (key == "height")
+    { settings.height = (int)std::max(1.0, number); }
+    else if (key == "fov")
+    { settings.fov = (float)number; }
+    else if (key == "seed")
+    { settings.seed = (Uint32)number; }
+    else if (key == "sizes" && value == "uniform")
+    { settings.sizes = StressSizes3D::Uniform; }
+    else if (key == "sizes" && value == "log")
+    { settings.sizes = StressSizes3D::LogUniform; }
+    else if (key == "order" && value == "front")
+    { settings.order = StressOrder3D::FrontToBack; }
+    else if (key == "order" && value == "back")
+    { settings.order = StressOrder3D::BackToFront; }
+    else if (key == "order" && value == "random")
+    { settings.order = StressOrder3D::Random; }
+    else
+    { return false; }
+    
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,224 @@
+#pragma once
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "color.hpp"
+#include "math.hpp"
+#include "image.hpp"
+#include "renderer.hpp"
+
+
+// reuses the previous frame's pixels by moving them to where they would be from the current camera, so that only
+// tiles with holes in them (plus a few tiles refreshed in turn, to pick up moving objects) need to be drawn again
+struct TemporalReprojector3D
+{
+    // one in this many tiles gets redrawn every frame no matter what, so that no pixel stays stale for too long
+    int refresh_period = 8;
+    
+    // if more than this fraction of tiles needs to be redrawn anyway, the whole target is redrawn instead
+    float max_dirty_ratio = 0.75f;
+    
+    // the previous frame, and the camera it was drawn from
+    std::vector<Uint32> colors;
+    std::vector<float> depths;
+    Camera3D camera{ glm::vec3(0.0f), 0.0f, 0.0f };
+    bool has_history = false;
+    Uint32 frame = 0;
+    
+    // which pixels of the current frame were covered by pixels from the previous one
+    std::vector<Uint8> covered;
+    
+    // forgets the previous frame, so that the next one gets drawn in full (do this after a cut or a teleport)
+    inline void Reset()
+    {
+        has_history = false;
+    }
+    
+    // clears the target, fills it with the previous frame as seen from the given camera, and masks it so that
+    // only tiles that need to be drawn again can be drawn to (returns how many tiles need to be drawn)
+    inline size_t Begin(Target& target, const Camera3D& camera, const Screen& screen, const Color3D& clear_color)
+    {
+        auto& image = target.image;
+        auto width = image.width;
+        auto height = image.height;
+        auto tile_columns = target.GetTileColumns();
+        auto tile_rows = target.GetTileRows();
+        auto tile_count = (size_t)(tile_columns * tile_rows);
+        
+        target.tile_mask.clear();
+        target.ClearSurface(clear_color);
+        target.ClearDepth();
+        
+        // reprojecting needs 32 bit pixels and a previous frame of the same size
+        if (!has_history || image.GetBytesPerPixel() != 4 || colors.size() != (size_t)(width * height))
+        { return tile_count; }
+        
+        // a point in the previous view space ends up at origin + axes * point in the current view space
+        auto origin = TranslateToView(this->camera.pos, camera);
+        auto axis_x = TranslateToView(TranslateToWorld(glm::vec3(1.0f, 0.0f, 0.0f), this->camera), camera) - origin;
+        auto axis_y = TranslateToView(TranslateToWorld(glm::vec3(0.0f, 1.0f, 0.0f), this->camera), camera) - origin;
+        auto axis_z = TranslateToView(TranslateToWorld(glm::vec3(0.0f, 0.0f, 1.0f), this->camera), camera) - origin;
+        
+        // view space direction of each previous pixel column and row, at a depth of one
+        std::vector<float> columns(width);
+        std::vector<float> rows(height);
+        
+        for (int x = 0; x < width; ++x)
+        { columns[x] = UnscaleFromScreen(glm::vec3(x + 0.5f, 0.0f, 1.0f), screen).x; }
+        
+        for (int y = 0; y < height; ++y)
+        { rows[y] = UnscaleFromScreen(glm::vec3(0.0f, y + 0.5f, 1.0f), screen).y; }
+        
+        // move every previous pixel to its new place, keeping the closest one when several land on the same pixel
+        covered.assign(width * height, 0);
+        
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                auto i = y * width + x;
+                auto depth = depths[i];
+                auto background = depth >= 1.0f;
+                
+                // the background is infinitely far away, so only the camera's rotation can move it
+                glm::vec3 pos;
+                
+                if (background)
+                { pos = axis_x * columns[x] + axis_y * rows[y] + axis_z; }
+                else
+                {
+                    auto z = depth * 10000.0f;
+                    pos = origin + axis_x * (columns[x] * z) + axis_y * (rows[y] * z) + axis_z * z;
+                }
+                
+                if (pos.z < 0.1f)
+                { continue; }
+                
+                auto screen_pos = ScaleToScreen(pos, screen);
+                auto xx = (int)std::floor(screen_pos.x);
+                auto yy = (int)std::floor(screen_pos.y);
+                
+                if (xx < 0 || xx >= width || yy < 0 || yy >= height)
+                { continue; }
+                
+                auto ii = yy * width + xx;
+                auto new_depth = background ? 1.0f : pos.z / 10000.0f;
+                
+                if (background ? target.depth_buffer[ii] < 1.0f : new_depth >= target.depth_buffer[ii])
+                { continue; }
+                
+                target.depth_buffer[ii] = new_depth;
+                image.GetPixelRow(yy)[xx] = colors[i];
+                covered[ii] = 1;
+            }
+        }
+        
+        // pixels that nothing landed on between two similar neighbors are cracks caused by the surface stretching,
+        // not parts of the scene that were hidden last frame, so they get patched from their neighbors
+        for (int y = 1; y < height - 1; ++y)
+        {
+            for (int x = 1; x < width - 1; ++x)
+            {
+                auto i = y * width + x;
+                
+                if (covered[i] != 0)
+                { continue; }
+                
+                for (auto [a, b]: { std::pair{ i - 1, i + 1 }, std::pair{ i - width, i + width } })
+                {
+                    auto depth_a = target.depth_buffer[a];
+                    auto depth_b = target.depth_buffer[b];
+                    
+                    if (covered[a] != 1 || covered[b] != 1 || std::abs(depth_a - depth_b) > 0.01f * std::max(depth_a, depth_b))
+                    { continue; }
+                    
+                    target.depth_buffer[i] = std::max(depth_a, depth_b);
+                    image.GetPixelRow(y)[x] = image.GetPixelRow(a / width)[a % width];
+                    covered[i] = 2;
+                    break;
+                }
+            }
+        }
+        
+        // any tile with a hole left in it, or whose turn it is to be refreshed, needs to be drawn again
+        std::vector<Uint8> mask(tile_count, 0);
+        size_t dirty_count = 0;
+        
+        for (int ty = 0; ty < tile_rows; ++ty)
+        {
+            for (int tx = 0; tx < tile_columns; ++tx)
+            {
+                auto tile_i = ty * tile_columns + tx;
+                auto dirty = ((Uint32)tile_i + frame) % (Uint32)refresh_period == 0;
+                
+                for (int y = ty * Target::tile_size; !dirty && y < std::min((ty + 1) * Target::tile_size, height); ++y)
+                {
+                    for (int x = tx * Target::tile_size; x < std::min((tx + 1) * Target::tile_size, width); ++x)
+                    {
+                        if (covered[y * width + x] == 0)
+                        {
+                            dirty = true;
+                            break;
+                        }
+                    }
+                }
+                
+                if (dirty)
+                {
+                    mask[tile_i] = 1;
+                    dirty_count += 1;
+                }
+            }
+        }
+        
+        // when most of the screen changed, drawing everything is simpler and not much slower
+        if (dirty_count > max_dirty_ratio * tile_count)
+        {
+            target.ClearSurface(clear_color);
+            target.ClearDepth();
+            return tile_count;
+        }
+        
+        // clear tiles that are about to be drawn again, so that stale pixels can't hide new ones
+        for (int ty = 0; ty < tile_rows; ++ty)
+        {
+            for (int tx = 0; tx < tile_columns; ++tx)
+            {
+                if (mask[ty * tile_columns + tx] != 0)
+                { target.ClearTile(tx, ty, clear_color); }
+            }
+        }
+        
+        target.tile_mask = std::move(mask);
+        return dirty_count;
+    }
+    
+    // remembers the finished frame and the camera it was drawn from, and lets the whole target be drawn to again
+    inline void End(Target& target, const Camera3D& camera)
+    {
+        auto& image = target.image;
+        
+        target.tile_mask.clear();
+        frame += 1;
+        
+        if (image.GetBytesPerPixel() != 4)
+        {
+            has_history = false;
+            return;
+        }
+        
+        colors.resize(image.width * image.height);
+        
+        for (int y = 0; y < image.height; ++y)
+        {
+            std::memcpy(&colors[y * image.width], image.GetPixelRow(y), image.width * sizeof(Uint32));
+        }
+        
+        depths = target.depth_buffer;
+        this->camera = camera;
+        has_history = true;
+    }
+};
\ No newline at end of file
@@ -0,0 +1,210 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include "color.hpp"
+#include "image.hpp"
+#include "parallel.hpp"
+#include "simd.hpp"
+
+
+// how a target lays out its pixels and depths in memory while it's being drawn to
+enum class TargetLayout3D
+{
+    // straight in the image and depth buffer, row by row
+    Linear,
+    
+    // tile by tile in a TiledSurface3D, and only copied into the image row by row when asked to
+    Tiled,
+};
+
+
+// the pixels and depths of a target stored tile by tile, so that everything drawing to a tile touches is a single
+// contiguous block of memory rather than a separate row of the image and depth buffer for every line of it
+// (each tile holds its pixels as 32 bit values in the image's format, row by row, followed by as many depths, and
+// starts on a cache line boundary; copies of a surface share its memory, like copies of images do)
+struct TiledSurface3D
+{
+    static constexpr int tile_size = 16;
+    static constexpr size_t tile_pixels = (size_t)tile_size * tile_size;
+    static constexpr size_t cache_line = 64;
+    static constexpr size_t huge_page = 2 * 1024 * 1024;
+    
+    int width = 0;
+    int height = 0;
+    int columns = 0;
+    int rows = 0;
+    Uint32* data = nullptr;
+    std::shared_ptr<Uint32> storage;
+    
+    // constructs an empty surface
+    inline TiledSurface3D() = default;
+    
+    // constructs a surface covering the given number of pixels, with every pixel 0 and every depth 1
+    // (with huge_pages, the memory is aligned to and asks Linux to back it with 2MB pages, so that a big target only
+    // needs a handful of TLB entries; elsewhere it's just aligned)
+    inline TiledSurface3D(int width, int height, bool huge_pages = false):
+        width(width),
+        height(height),
+        columns((width + tile_size - 1) / tile_size),
+        rows((height + tile_size - 1) / tile_size)
+    {
+        auto alignment = huge_pages ? huge_page : cache_line;
+        auto size = std::max<size_t>((size_t)columns * rows * tile_pixels * 2 * sizeof(Uint32), 1);
+        size = (size + alignment - 1) / alignment * alignment;
+        
+        auto buffer = (Uint32*)::operator new(size, std::align_val_t(alignment));
+
+#if defined(__linux__)
+        if (huge_pages)
+        { madvise(buffer, size, MADV_HUGEPAGE); }
+#endif
+
+        storage = std::shared_ptr<Uint32>(buffer, [alignment](Uint32* p) { ::operator delete(p, std::align_val_t(alignment)); });
+        data = buffer;
+        
+        // with pinned threads, every row of tiles is first written by the thread ParallelFor hands that row to, which
+        // puts its memory on that thread's node, so work split across rows of tiles the same way stays on it
+        if (GetThreadPlacement().pin)
+        {
+            ParallelFor(rows, [&](size_t begin, size_t end)
+            {
+                for (auto ty = (int)begin; ty < (int)end; ++ty)
+                {
+                    for (int tx = 0; tx < columns; ++tx)
+                    {
+                        FillTile(tx, ty, 0, 1.0f);
+                    }
+                }
+            });
+        }
+        else
+        {
+            FillPixels(0);
+            FillDepths(1.0f);
+        }
+    }
+    
+    // whether the surface has any memory to draw to
+    inline bool IsEmpty() const
+    {
+        return data == nullptr;
+    }
+    
+    // returns the pixels of a single tile, which are followed by its depths
+    inline Uint32* GetTilePixels(int tile_x, int tile_y) const
+    {
+        return data + ((size_t)tile_y * columns + tile_x) * tile_pixels * 2;
+    }
+    
+    // returns the depths of a single tile
+    inline float* GetTileDepths(int tile_x, int tile_y) const
+    {
+        return (float*)(GetTilePixels(tile_x, tile_y) + tile_pixels);
+    }
+    
+    // returns where the given pixel is within the pixels (or depths) of its tile
+    inline static size_t GetTileOffset(int x, int y)
+    {
+        return (size_t)(y & (tile_size - 1)) * tile_size + (x & (tile_size - 1));
+    }
+    
+    // returns a single pixel (the pixel must exist)
+    inline Uint32& Pixel(int x, int y) const
+    {
+        return GetTilePixels(x / tile_size, y / tile_size)[GetTileOffset(x, y)];
+    }
+    
+    // returns a single depth (the pixel must exist)
+    inline float& Depth(int x, int y) const
+    {
+        return GetTileDepths(x / tile_size, y / tile_size)[GetTileOffset(x, y)];
+    }
+    
+    // fills a single tile's pixels and depths (pixels beyond the edges of the surface get filled too, which is harmless)
+    inline void FillTile(int tile_x, int tile_y, Uint32 pixel, float depth)
+    {
+        GetSimdKernels().fill_pixels(GetTilePixels(tile_x, tile_y), tile_pixels, pixel);
+        GetSimdKernels().fill_depth(GetTileDepths(tile_x, tile_y), tile_pixels, depth);
+    }
+    
+    // fills every tile's pixels with a single value
+    inline void FillPixels(Uint32 pixel)
+    {
+        for (int ty = 0; ty < rows; ++ty)
+        {
+            for (int tx = 0; tx < columns; ++tx)
+            {
+                GetSimdKernels().fill_pixels(GetTilePixels(tx, ty), tile_pixels, pixel);
+            }
+        }
+    }
+    
+    // fills every tile's depths with a single value
+    inline void FillDepths(float depth)
+    {
+        for (int ty = 0; ty < rows; ++ty)
+        {
+            for (int tx = 0; tx < columns; ++tx)
+            {
+                GetSimdKernels().fill_depth(GetTileDepths(tx, ty), tile_pixels, depth);
+            }
+        }
+    }
+    
+    // copies the pixels of a linear image of the same size into the tiles
+    inline void Tile(const Image3D& image)
+    {
+        for (int y = 0; y < std::min(height, image.height); ++y)
+        {
+            for (int x = 0; x < std::min(width, image.width); ++x)
+            {
+                Pixel(x, y) = image.ReadPixel(x, y);
+            }
+        }
+    }
+    
+    // copies the tiles' pixels into a linear image of the same size, and their depths into a depth buffer of the same
+    // size, if one is given (32 bit images get whole rows of tiles copied at once)
+    inline void Detile(Image3D& image, std::vector<float>* depths = nullptr) const
+    {
+        auto copy_width = std::min(width, image.width);
+        auto copy_height = std::min(height, image.height);
+        
+        for (int y = 0; y < copy_height; ++y)
+        {
+            auto row = image.GetPixelRow(y);
+            
+            for (int tx = 0; tx * tile_size < copy_width; ++tx)
+            {
+                auto x = tx * tile_size;
+                auto count = std::min(tile_size, copy_width - x);
+                auto pixels = GetTilePixels(tx, y / tile_size) + GetTileOffset(0, y);
+                
+                if (image.format == PixelFormat3D::ARGB8888)
+                {
+                    std::memcpy(row + x, pixels, count * sizeof(Uint32));
+                }
+                else
+                {
+                    for (int i = 0; i < count; ++i)
+                    { image.WritePixel(x + i, y, pixels[i]); }
+                }
+                
+                if (depths != nullptr)
+                {
+                    auto tile_depths = GetTileDepths(tx, y / tile_size) + GetTileOffset(0, y);
+                    std::memcpy(depths->data() + (size_t)y * image.width + x, tile_depths, count * sizeof(float));
+                }
+            }
+        }
+    }
+};
\ No newline at end of file
@@ -0,0 +1,470 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+namespace fs = std::filesystem;
+
+#include <glm/glm.hpp>
+
+#include "color.hpp"
+#include "math.hpp"
+#include "image.hpp"
+
+
+// the start of a virtual texture file, which is followed by every page of every mip level as raw ARGB8888 pixels
+// (pages are stored from the most detailed mip level to the least, each level row by row)
+struct VirtualTextureHeader3D
+{
+    char magic[4] = { 'S', 'V', 'T', '3' };
+    Uint32 version = 1;
+    Uint32 width = 0;
+    Uint32 height = 0;
+    Uint32 page_size = 0;
+    Uint32 mip_count = 0;
+};
+
+
+// returns how many mip levels a virtual texture of the given size has (halving it until a single page covers it)
+inline int GetVirtualMipCount(int width, int height, int page_size)
+{
+    int mip_count = 1;
+    
+    while (std::max(width >> (mip_count - 1), height >> (mip_count - 1)) > page_size)
+    {
+        mip_count += 1;
+    }
+    
+    return mip_count;
+}
+
+
+// splits an image into pages of every mip level and saves them to a file that a VirtualTexture3D can stream from
+// (mip levels are made by averaging blocks of 2x2 pixels in linear light, and pages along the right and bottom edges repeat edge pixels)
+inline bool SaveVirtualTexture(const fs::path& filepath, const Image3D& image, int page_size = 128)
+{
+    std::ofstream file(filepath, std::ios::binary);
+    
+    if (!file || image.IsEmpty() || page_size <= 0)
+    { return false; }
+    
+    VirtualTextureHeader3D header;
+    header.width = image.width;
+    header.height = image.height;
+    header.page_size = page_size;
+    header.mip_count = GetVirtualMipCount(image.width, image.height, page_size);
+    
+    file.write((const char*)&header, sizeof(header));
+    
+    // the most detailed level is the image itself, in ARGB8888
+    auto level = ConvertImage(image, PixelFormat3D::ARGB8888);
+    std::vector<Uint32> page((size_t)page_size * page_size);
+    
+    for (Uint32 mip = 0; mip < header.mip_count; ++mip)
+    {
+        if (mip > 0)
+        {
+            Image3D next(std::max(1, level.width / 2), std::max(1, level.height / 2));
+            
+            for (int y = 0; y < next.height; ++y)
+            {
+                for (int x = 0; x < next.width; ++x)
+                {
+                    Color3D texels[4];
+                    
+                    for (int i = 0; i < 4; ++i)
+                    {
+                        texels[i] = level.Read(std::min(x * 2 + (i & 1), level.width - 1), std::min(y * 2 + (i >> 1), level.height - 1));
+                    }
+                    
+                    // colors are averaged in linear light, so that mip levels don't get darker than the image
+                    auto& tables = GetSrgbTables();
+                    
+                    next.GetPixelRow(y)[x] = PackARGB8888(Color3D
+                    {
+                        tables.Average(texels[0].r, texels[1].r, texels[2].r, texels[3].r),
+                        tables.Average(texels[0].g, texels[1].g, texels[2].g, texels[3].g),
+                        tables.Average(texels[0].b, texels[1].b, texels[2].b, texels[3].b),
+                        Uint8((texels[0].a + texels[1].a + texels[2].a + texels[3].a + 2) / 4),
+                    });
+                }
+            }
+            
+            level = next;
+        }
+        
+        for (int py = 0; py < (level.height + page_size - 1) / page_size; ++py)
+        {
+            for (int px = 0; px < (level.width + page_size - 1) / page_size; ++px)
+            {
+                for (int y = 0; y < page_size; ++y)
+                {
+                    auto row = level.GetPixelRow(std::min(py * page_size + y, level.height - 1));
+                    
+                    for (int x = 0; x < page_size; ++x)
+                    {
+                        page[y * page_size + x] = row[std::min(px * page_size + x, level.width - 1)];
+                    }
+                }
+                
+                file.write((const char*)page.data(), page.size() * sizeof(Uint32));
+            }
+        }
+    }
+    
+    return (bool)file;
+}
+
+
+// a texture far bigger than memory, split into pages on disk of which only the ones recently seen are kept in a cache
+// of a fixed size (drawing writes which pages it would've liked to sample into a small feedback buffer, Update then
+// asks a background thread to load those, and pages that aren't loaded yet are sampled from less detailed mip levels,
+// the least detailed of which always stays loaded)
+struct VirtualTexture3D
+{
+    static constexpr Uint32 none = std::numeric_limits<Uint32>::max();
+    
+    // feedback is written for one pixel in every block of this many pixels squared, a different one each frame
+    static constexpr int feedback_block = 4;
+    
+    // what's in the file, and where each mip level's pages start in it
+    fs::path filepath;
+    int width = 0;
+    int height = 0;
+    int page_size = 0;
+    std::vector<glm::ivec2> mip_pages;
+    std::vector<Uint32> mip_first_page;
+    
+    // the cache, as slots of pages laid out in rows of a single image, along with which page each slot holds and when
+    // it was last sampled (slots holding the least detailed mip level are never replaced)
+    Image3D cache;
+    int slot_columns = 0;
+    std::vector<Uint32> slot_pages;
+    std::vector<Uint64> slot_used;
+    std::vector<Uint8> slot_pinned;
+    
+    // the page table, holding which slot each page of every mip level is in, if any
+    std::vector<Uint32> page_slots;
+    
+    // pages the last frames wanted to sample, one per block of pixels (0 for none, otherwise a page's index plus 1)
+    std::unique_ptr<std::atomic<Uint32>[]> feedback;
+    int feedback_width = 0;
+    int feedback_height = 0;
+    glm::ivec2 feedback_phase = glm::ivec2(0, 0);
+    Uint64 frame = 0;
+    
+    // pages waiting to be loaded and pages that finished loading, shared with the streaming thread
+    std::thread streamer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<Uint32> requests;
+    std::vector<std::pair<Uint32, std::vector<Uint32>>> loaded;
+    std::vector<Uint8> pending;
+    bool stopping = false;
+    
+    // how many pages were loaded into the cache, and how many had to make room for them
+    size_t pages_loaded = 0;
+    size_t pages_evicted = 0;
+    
+    inline VirtualTexture3D() = default;
+    VirtualTexture3D(const VirtualTexture3D&) = delete;
+    VirtualTexture3D& operator=(const VirtualTexture3D&) = delete;
+    
+    inline ~VirtualTexture3D()
+    {
+        Close();
+    }
+    
+    // opens a file saved by SaveVirtualTexture with a cache of the given number of pages, loads its least detailed mip
+    // level, and starts streaming (returns false if the file can't be read or the cache is too small)
+    inline bool Open(const fs::path& path, int cache_pages = 64)
+    {
+        Close();
+        
+        std::ifstream file(path, std::ios::binary);
+        VirtualTextureHeader3D header;
+        
+        if (!file || !file.read((char*)&header, sizeof(header)) || std::memcmp(header.magic, VirtualTextureHeader3D().magic, 4) != 0)
+        { return false; }
+        
+        if (header.version != 1 || header.page_size == 0 || (int)header.mip_count != GetVirtualMipCount(header.width, header.height, header.page_size))
+        { return false; }
+        
+        filepath = path;
+        width = header.width;
+        height = header.height;
+        page_size = header.page_size;
+        mip_pages.clear();
+        mip_first_page.clear();
+        
+        Uint32 page_count = 0;
+        
+        for (Uint32 mip = 0; mip < header.mip_count; ++mip)
+        {
+            auto mip_width = std::max(1, width >> mip);
+            auto mip_height = std::max(1, height >> mip);
+            
+            mip_first_page.push_back(page_count);
+            mip_pages.push_back(glm::ivec2((mip_width + page_size - 1) / page_size, (mip_height + page_size - 1) / page_size));
+            page_count += mip_pages.back().x * mip_pages.back().y;
+        }
+        
+        // the least detailed level has to fit with room to spare
+        if (cache_pages < 2)
+        { return false; }
+        
+        slot_columns = std::min(cache_pages, 16);
+        cache = Image3D(slot_columns * page_size, (cache_pages + slot_columns - 1) / slot_columns * page_size);
+        slot_pages.assign(cache_pages, none);
+        slot_used.assign(cache_pages, 0);
+        slot_pinned.assign(cache_pages, 0);
+        page_slots.assign(page_count, none);
+        pending.assign(page_count, 0);
+        requests.clear();
+        loaded.clear();
+        frame = 0;
+        
+        // load the least detailed level right away, so there's always something to sample
+        auto coarsest = mip_first_page.back();
+        file.seekg(sizeof(header) + (std::streamoff)coarsest * page_size * page_size * sizeof(Uint32));
+        
+        std::vector<Uint32> pixels((size_t)page_size * page_size);
+        
+        if (!file.read((char*)pixels.data(), pixels.size() * sizeof(Uint32)))
+        { return false; }
+        
+        Install(coarsest, pixels);
+        slot_pinned[page_slots[coarsest]] = 1;
+        
+        stopping = false;
+        streamer = std::thread([this]() { Stream(); });
+        
+        return true;
+    }
+    
+    // stops streaming and forgets every page
+    inline void Close()
+    {
+        if (streamer.joinable())
+        {
+            {
+                std::lock_guard lock(mutex);
+                stopping = true;
+            }
+            
+            wake.notify_all();
+            streamer.join();
+        }
+        
+        page_slots.clear();
+    }
+    
+    // whether a file is open and can be sampled from
+    inline bool IsOpen() const
+    {
+        return !page_slots.empty();
+    }
+    
+    // loads requested pages until the texture gets closed (runs on the streaming thread)
+    inline void Stream()
+    {
+        std::ifstream file(filepath, std::ios::binary);
+        
+        while (true)
+        {
+            Uint32 page;
+            
+            {
+                std::unique_lock lock(mutex);
+                wake.wait(lock, [&]() { return stopping || !requests.empty(); });
+                
+                if (stopping)
+                { return; }
+                
+                page = requests.back();
+                requests.pop_back();
+            }
+            
+            std::vector<Uint32> pixels((size_t)page_size * page_size);
+            file.clear();
+            file.seekg(sizeof(VirtualTextureHeader3D) + (std::streamoff)page * page_size * page_size * sizeof(Uint32));
+            
+            if (!file.read((char*)pixels.data(), pixels.size() * sizeof(Uint32)))
+            { pixels.assign(pixels.size(), PackARGB8888(Color3D{ 0, 0, 0, 255 })); }
+            
+            std::lock_guard lock(mutex);
+            loaded.emplace_back(page, std::move(pixels));
+        }
+    }
+    
+    // copies a page into the least recently used slot that wasn't sampled last frame (returns false if there's none)
+    inline bool Install(Uint32 page, const std::vector<Uint32>& pixels)
+    {
+        Uint32 slot = none;
+        
+        for (Uint32 s = 0; s < slot_pages.size(); ++s)
+        {
+            if (slot_pinned[s] == 0 && (slot == none || slot_used[s] < slot_used[slot]))
+            { slot = s; }
+        }
+        
+        if (slot == none || (slot_pages[slot] != none && slot_used[slot] >= frame))
+        { return false; }
+        
+        if (slot_pages[slot] != none)
+        {
+            page_slots[slot_pages[slot]] = none;
+            pages_evicted += 1;
+        }
+        
+        auto x = (slot % slot_columns) * page_size;
+        auto y = (slot / slot_columns) * page_size;
+        
+        for (int row = 0; row < page_size; ++row)
+        {
+            std::memcpy(cache.GetPixelRow(y + row) + x, &pixels[row * page_size], page_size * sizeof(Uint32));
+        }
+        
+        slot_pages[slot] = page;
+        slot_used[slot] = frame;
+        page_slots[page] = slot;
+        pages_loaded += 1;
+        
+        return true;
+    }
+    
+    // reads the feedback drawn since the last update, moves pages that finished loading into the cache, and asks for
+    // the rest to be loaded, least detailed first (call this once per frame while nothing is sampling the texture, with
+    // the size of the target it's drawn into)
+    inline void Update(int target_width, int target_height)
+    {
+        if (!IsOpen())
+        { return; }
+        
+        frame += 1;
+        
+        std::lock_guard lock(mutex);
+        
+        // requests that weren't started on yet get made again below if they're still wanted
+        for (auto page: requests)
+        {
+            pending[page] = 0;
+        }
+        
+        requests.clear();
+        
+        // keep pages that were sampled in the cache, and request the ones that were missing
+        for (int i = 0; i < feedback_width * feedback_height; ++i)
+        {
+            auto value = feedback[i].exchange(0, std::memory_order_relaxed);
+            
+            if (value == 0)
+            { continue; }
+            
+            auto page = value - 1;
+            
+            if (page_slots[page] != none)
+            { slot_used[page_slots[page]] = frame; }
+            else if (pending[page] == 0)
+            {
+                pending[page] = 1;
+                requests.push_back(page);
+            }
+        }
+        
+        // pages that got loaded go in slots that weren't sampled last frame (or get dropped, if every slot was)
+        for (auto& [page, pixels]: loaded)
+        {
+            pending[page] = 0;
+            
+            if (page_slots[page] == none)
+            { Install(page, pixels); }
+        }
+        
+        loaded.clear();
+        
+        // pages of less detailed levels come later in the file, and the streaming thread starts at the back
+        std::sort(requests.begin(), requests.end());
+        
+        if (!requests.empty())
+        { wake.notify_one(); }
+        
+        // resize the feedback buffer to the target, and move to the next pixel of every block
+        auto next_width = (target_width + feedback_block - 1) / feedback_block;
+        auto next_height = (target_height + feedback_block - 1) / feedback_block;
+        
+        if (next_width != feedback_width || next_height != feedback_height)
+        {
+            feedback_width = next_width;
+            feedback_height = next_height;
+            feedback = std::make_unique<std::atomic<Uint32>[]>((size_t)feedback_width * feedback_height);
+        }
+        
+        auto phase = (int)(frame % (feedback_block * feedback_block));
+        feedback_phase = glm::ivec2(phase % feedback_block, phase / feedback_block);
+    }
+    
+    // picks the mip level whose texels are closest to, but no bigger than, the pixels of a triangle covering the given
+    // areas of pixels and of texels of the most detailed level
+    inline int ChooseMip(float pixel_area, float texel_area) const
+    {
+        if (pixel_area <= 0.0f || texel_area <= pixel_area)
+        { return 0; }
+        
+        auto mip = (int)std::floor(0.5f * std::log2(texel_area / pixel_area));
+        return std::clamp(mip, 0, (int)mip_pages.size() - 1);
+    }
+    
+    // samples the texture at the given normalized coordinates and mip level, like Sample does an image, falling back to
+    // less detailed levels where pages aren't loaded (the pixel being drawn decides where feedback gets written)
+    inline Color3D Sample(float u, float v, int mip, int pixel_x, int pixel_y) const
+    {
+        auto wanted = true;
+        
+        for (; mip < (int)mip_pages.size(); ++mip)
+        {
+            auto mip_width = std::max(1, width >> mip);
+            auto mip_height = std::max(1, height >> mip);
+            auto x = (int)Lerp(0.0f, float(mip_width), u);
+            auto y = (int)Lerp(float(mip_height), 0.0f, v);
+            
+            if (x < 0 || x > mip_width || y < 0 || y > mip_height)
+            { return { 0, 0, 0, 255 }; }
+            
+            x = std::min(x, mip_width - 1);
+            y = std::min(y, mip_height - 1);
+            
+            auto page = mip_first_page[mip] + (y / page_size) * mip_pages[mip].x + x / page_size;
+            
+            // only the page that would ideally be sampled gets asked for
+            if (wanted && pixel_x % feedback_block == feedback_phase.x && pixel_y % feedback_block == feedback_phase.y)
+            {
+                auto fx = pixel_x / feedback_block;
+                auto fy = pixel_y / feedback_block;
+                
+                if (fx < feedback_width && fy < feedback_height)
+                { feedback[fy * feedback_width + fx].store(page + 1, std::memory_order_relaxed); }
+            }
+            
+            wanted = false;
+            
+            if (auto slot = page_slots[page]; slot != none)
+            {
+                auto cache_x = (int)(slot % slot_columns) * page_size + x % page_size;
+                auto cache_y = (int)(slot / slot_columns) * page_size + y % page_size;
+                return UnpackARGB8888(cache.GetPixelRow(cache_y)[cache_x]);
+            }
+        }
+        
+        return { 0, 0, 0, 255 };
+    }
+};
\ No newline at end of file